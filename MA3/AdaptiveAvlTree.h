@@ -0,0 +1,530 @@
+#ifndef ADAPTIVE_AVL_TREE_H
+#define ADAPTIVE_AVL_TREE_H
+
+#include "AvlTree.h"
+#include <array>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// AdaptiveAvlTree class
+//
+// CONSTRUCTION: like AvlTree
+//
+// An AvlTree that keeps small sets in a sorted array stored inline in the
+// object instead of in nodes. Up to INLINE items, lookups are a single
+// branch-free counting scan over contiguous memory, which the compiler can
+// vectorize for arithmetic keys, and inserts shift the array. The
+// insert that would overflow the array promotes it to a tree, built in
+// O(n) with assignSorted( ). When a promoted set shrinks to INLINE / 2
+// items it moves back into the array. The gap stops a set of about INLINE
+// items from flipping back and forth.
+//
+// The whole AvlTree API works in both modes. Shape-dependent printing,
+// split( ) and join( ) work on a tree, building one first if needed.
+// Comparable must be default constructible.
+//
+// ******************PUBLIC OPERATIONS*********************
+// bool isInline( )       --> True while the items live in the array
+// ... plus everything AvlTree provides; split( ) and join( ) take an
+//     AdaptiveAvlTree
+// ******************ERRORS********************************
+// As AvlTree
+
+template <typename Comparable, typename Balance = AvlBalance, int INLINE = 32>
+class AdaptiveAvlTree
+{
+    static_assert( INLINE >= 2, "The inline array needs room to demote into" );
+
+  public:
+    typedef AvlTree<Comparable, Balance> Tree;
+
+    AdaptiveAvlTree( ) : tree( ), used( 0 ), promoted( false ), modifications( 0 )
+    {
+    }
+
+    explicit AdaptiveAvlTree( bool isMultiset )
+      : tree( isMultiset ), used( 0 ), promoted( false ), modifications( 0 )
+    {
+    }
+
+    AdaptiveAvlTree( vector<Comparable> vals ) : AdaptiveAvlTree( )
+    {
+        insert( vals );
+    }
+
+    bool isInline( ) const
+    {
+        return !promoted;
+    }
+
+    void makeEmpty( )
+    {
+        modifications++;
+        tree.makeEmpty( );
+        clearInline( );
+        promoted = false;
+    }
+
+    void setDeferredDestruction( bool on )
+    {
+        tree.setDeferredDestruction( on );
+    }
+
+    bool deferredDestruction( ) const
+    {
+        return tree.deferredDestruction( );
+    }
+
+    /**
+     * Lazy deletion applies once promoted; inline removes are already
+     *  just a shift.
+     */
+    void setLazyDeletion( double fraction )
+    {
+        tree.setLazyDeletion( fraction );
+    }
+
+    double lazyDeletion( ) const
+    {
+        return tree.lazyDeletion( );
+    }
+
+    int tombstoneCount( ) const
+    {
+        return tree.tombstoneCount( );
+    }
+
+    void compact( )
+    {
+        tree.compact( );
+    }
+
+    /**
+     * Find the smallest item in the tree.
+     * Throw UnderflowException if empty.
+     */
+    const Comparable & findMin( ) const
+    {
+        if( promoted )
+            return tree.findMin( );
+        if( used == 0 )
+            throw UnderflowException( );
+        return items[0];
+    }
+
+    /**
+     * Find the largest item in the tree.
+     * Throw UnderflowException if empty.
+     */
+    const Comparable & findMax( ) const
+    {
+        if( promoted )
+            return tree.findMax( );
+        if( used == 0 )
+            throw UnderflowException( );
+        return items[used - 1];
+    }
+
+    bool contains( const Comparable & x ) const
+    {
+        if( promoted )
+            return tree.contains( x );
+        int pos = lowerBound( x );
+        return pos < used && !( x < items[pos] );
+    }
+
+    bool isEmpty( ) const
+    {
+        return size( ) == 0;
+    }
+
+    bool empty( )
+    {
+        return isEmpty( );
+    }
+
+    int size( ) const
+    {
+        return promoted ? tree.size( ) : used;
+    }
+
+    int count( const Comparable & x ) const
+    {
+        if( promoted )
+            return tree.count( x );
+        return upperBound( x ) - lowerBound( x );
+    }
+
+    /**
+     * Return the k-th smallest item, counting from 0.
+     * Throw ArrayIndexOutOfBoundsException if k is not in [0, size).
+     */
+    const Comparable & findKth( int k ) const
+    {
+        if( promoted )
+            return tree.findKth( k );
+        if( k < 0 || k >= used )
+            throw ArrayIndexOutOfBoundsException( );
+        return items[k];
+    }
+
+    int rank( const Comparable & x ) const
+    {
+        return promoted ? tree.rank( x ) : lowerBound( x );
+    }
+
+    unsigned long version( ) const
+    {
+        return modifications;
+    }
+
+    bool isMultiset( ) const
+    {
+        return tree.isMultiset( );
+    }
+
+    /**
+     * Height the items would have as a perfectly balanced tree while
+     *  inline (null == -1).
+     */
+    int height( ) const
+    {
+        if( promoted )
+            return tree.height( );
+        int h = -1;
+        for( int nodes = distinct( ); nodes > 0; nodes /= 2 )
+            h++;
+        return h;
+    }
+
+    void printTree( ) const
+    {
+        printInOrder( );
+    }
+
+    /**
+     * Print each distinct item once, as AvlTree prints each node.
+     */
+    void printInOrder( ) const
+    {
+        if( promoted )
+            tree.printInOrder( );
+        else if( used == 0 )
+            cout << "Empty tree" << endl;
+        else
+            for( int i = 0; i < used; i++ )
+                if( i == 0 || items[i - 1] < items[i] )
+                    cout << items[i] << " ";
+    }
+
+    void printPreOrder( ) const
+    {
+        if( promoted )
+            tree.printPreOrder( );
+        else
+            asTree( ).printPreOrder( );
+    }
+
+    void printPostOrder( ) const
+    {
+        if( promoted )
+            tree.printPostOrder( );
+        else
+            asTree( ).printPostOrder( );
+    }
+
+    void printLevelOrder( ) const
+    {
+        if( promoted )
+            tree.printLevelOrder( );
+        else
+            asTree( ).printLevelOrder( );
+    }
+
+    /**
+     * Insert x; the insert that overflows the array promotes it.
+     */
+    void insert( const Comparable & x )
+    {
+        modifications++;
+        if( !promoted )
+        {
+            int pos = lowerBound( x );
+            if( !isMultiset( ) && pos < used && !( x < items[pos] ) )
+                return;     // Duplicate; do nothing
+            if( used < INLINE )
+            {
+                for( int i = used; i > pos; i-- )
+                    items[i] = std::move( items[i - 1] );
+                items[pos] = x;
+                used++;
+                return;
+            }
+            promote( );
+        }
+        tree.insert( x );
+    }
+
+    void insert( vector<Comparable> vals )
+    {
+        for( const Comparable & x : vals )
+            insert( x );
+    }
+
+    /**
+     * Remove x (every occurrence, as AvlTree::remove does).
+     */
+    void remove( const Comparable & x )
+    {
+        modifications++;
+        if( promoted )
+        {
+            tree.remove( x );
+            settle( );
+        }
+        else
+            erase( lowerBound( x ), upperBound( x ) );
+    }
+
+    void removeOne( const Comparable & x )
+    {
+        modifications++;
+        if( promoted )
+        {
+            tree.removeOne( x );
+            settle( );
+        }
+        else
+        {
+            int pos = lowerBound( x );
+            if( pos < used && !( x < items[pos] ) )
+                erase( pos, pos + 1 );
+        }
+    }
+
+    void removeAll( const Comparable & x )
+    {
+        remove( x );
+    }
+
+    /**
+     * Move every item >= x into greater, which is emptied first.
+     */
+    void split( const Comparable & x, AdaptiveAvlTree & greater )
+    {
+        if( &greater == this )
+            return;
+        modifications++;
+        greater.makeEmpty( );
+        promote( );
+        tree.split( x, greater.tree );
+        greater.promoted = true;
+        settle( );
+        greater.settle( );
+    }
+
+    /**
+     * Append every item of greater and empty it.
+     * Throw IllegalArgumentException if the trees overlap.
+     */
+    void join( AdaptiveAvlTree & greater )
+    {
+        if( &greater == this || greater.isEmpty( ) )
+            return;
+        if( !isEmpty( ) && !( findMax( ) < greater.findMin( ) ) )
+            throw IllegalArgumentException( );
+        modifications++;
+        greater.modifications++;
+        promote( );
+        greater.promote( );
+        tree.join( greater.tree );
+        settle( );
+        greater.settle( );
+    }
+
+    /**
+     * Replace the contents with the sorted items in [first, last).
+     * Throw IllegalArgumentException if the input is out of order.
+     */
+    template <typename Iterator>
+    void assignSorted( Iterator first, Iterator last )
+    {
+        modifications++;
+        clearInline( );
+        promoted = true;
+        tree.assignSorted( first, last );
+        settle( );
+    }
+
+    int removeRange( const Comparable & lo, const Comparable & hi )
+    {
+        if( hi < lo )
+            return 0;
+        modifications++;
+        if( promoted )
+        {
+            int removed = tree.removeRange( lo, hi );
+            settle( );
+            return removed;
+        }
+        int from = lowerBound( lo ), to = upperBound( hi );
+        erase( from, to );
+        return to - from;
+    }
+
+    template <typename Predicate>
+    int removeIf( Predicate pred )
+    {
+        modifications++;
+        if( promoted )
+        {
+            int removed = tree.removeIf( pred );
+            settle( );
+            return removed;
+        }
+        int kept = 0;
+        for( int i = 0; i < used; i++ )
+            if( !pred( items[i] ) && kept++ != i )
+                items[kept - 1] = std::move( items[i] );   // Never onto itself
+        int removed = used - kept;
+        erase( kept, used );
+        return removed;
+    }
+
+    template <typename Func>
+    void forEach( Func f ) const
+    {
+        if( promoted )
+            tree.forEach( f );
+        else
+            for( int i = 0; i < used; i++ )
+                f( items[i] );
+    }
+
+    template <typename Func>
+    void forEachInRange( const Comparable & lo, const Comparable & hi, Func f ) const
+    {
+        if( promoted )
+            tree.forEachInRange( lo, hi, f );
+        else
+            for( int i = lowerBound( lo ); i < used && !( hi < items[i] ); i++ )
+                f( items[i] );
+    }
+
+    /**
+     * Inline sets are too small to be worth a thread; they run in order.
+     */
+    template <typename Func>
+    void parallelForEach( Func f ) const
+    {
+        if( promoted )
+            tree.parallelForEach( f );
+        else
+            forEach( f );
+    }
+
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce( T identity, Map map, Combine combine ) const
+    {
+        if( promoted )
+            return tree.parallelReduce( identity, map, combine );
+        T result = identity;
+        for( int i = 0; i < used; i++ )
+            result = combine( result, map( items[i] ) );
+        return result;
+    }
+
+  private:
+    Tree tree;                           // Holds the items once promoted
+    array<Comparable, INLINE> items;     // Sorted; [0, used) are live
+    int  used;
+    bool promoted;
+    unsigned long modifications;
+
+    /**
+     * Number of items less than x. Counting instead of breaking out keeps
+     *  the loop free of data-dependent branches.
+     */
+    int lowerBound( const Comparable & x ) const
+    {
+        int pos = 0;
+        for( int i = 0; i < used; i++ )
+            pos += items[i] < x;
+        return pos;
+    }
+
+    int upperBound( const Comparable & x ) const
+    {
+        int pos = 0;
+        for( int i = 0; i < used; i++ )
+            pos += !( x < items[i] );
+        return pos;
+    }
+
+    int distinct( ) const
+    {
+        int n = 0;
+        for( int i = 0; i < used; i++ )
+            n += i == 0 || items[i - 1] < items[i];
+        return n;
+    }
+
+    /**
+     * Drop items[from, to), closing the gap.
+     */
+    void erase( int from, int to )
+    {
+        if( from >= to )
+            return;
+        int gap = to - from;
+        for( int i = to; i < used; i++ )
+            items[i - gap] = std::move( items[i] );
+        for( int i = used - gap; i < used; i++ )
+            items[i] = Comparable( );     // Release what the item held
+        used -= gap;
+    }
+
+    void clearInline( )
+    {
+        erase( 0, used );
+    }
+
+    /**
+     * Move the inline items into the tree: O(n), no rotations.
+     */
+    void promote( )
+    {
+        if( promoted )
+            return;
+        tree.assignSorted( items.begin( ), items.begin( ) + used );
+        clearInline( );
+        promoted = true;
+    }
+
+    /**
+     * Move a promoted set that has shrunk back into the array.
+     */
+    void settle( )
+    {
+        if( !promoted || tree.size( ) > INLINE / 2 )
+            return;
+        used = 0;
+        tree.forEach( [ this ]( const Comparable & x ) { items[used++] = x; } );
+        tree.makeEmpty( );
+        promoted = false;
+    }
+
+    /**
+     * The inline items as a temporary AvlTree, for operations that
+     *  depend on its shape.
+     */
+    Tree asTree( ) const
+    {
+        Tree shaped( isMultiset( ) );
+        shaped.assignSorted( items.begin( ), items.begin( ) + used );
+        return shaped;
+    }
+};
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef AVL_BALANCE_H
+#define AVL_BALANCE_H
+
+#include <cstddef>     // For NULL
+
+// Balancing policies for AvlTree< Comparable, Balance >
+//
+// Every policy keeps a rank in each node's height field (NULL has rank -1)
+// and restores its rank rule bottom-up, one node at a time, as insert( )
+// and remove( ) unwind. Rotations never touch ranks unless the policy is
+// HEIGHT_BALANCED, in which case rank == height is recomputed by update( ).
+//
+// ******************POLICIES******************************
+// AvlBalance      --> Classic AVL: sibling heights differ by at most 1.
+//                     Up to O(log n) rotations per remove.
+// WavlBalance     --> Weak AVL: rank differences are 1 or 2, leaves rank 0.
+//                     Same shape as AVL without deletes, O(1) amortized
+//                     rotations per insert or remove.
+// RedBlackBalance --> Red-black tree as a rank rule: differences are 0 or 1
+//                     (0 == red) and no 0-child has a 0-child. At most
+//                     three rotations per remove.
+//
+// ******************POLICY INTERFACE**********************
+// HEIGHT_BALANCED       --> true if ranks are exact heights
+// JOIN_SLACK            --> Largest rank gap join( ) may hang a node across
+// afterInsert( tree, t ) --> Fix t after an insert below it
+// afterRemove( tree, t ) --> Fix t after a remove below it
+// builtRank( l, r )     --> Rank for a node of a perfectly balanced build
+
+struct AvlBalance
+{
+    static const bool HEIGHT_BALANCED = true;
+    static const int  JOIN_SLACK = 1;
+
+    template <typename Tree, typename Node>
+    static void afterInsert( Tree & tree, Node * & t )
+    {
+        tree.balance( t );
+    }
+
+    template <typename Tree, typename Node>
+    static void afterRemove( Tree & tree, Node * & t )
+    {
+        tree.balance( t );
+    }
+
+    static int builtRank( int leftRank, int rightRank )
+    {
+        return ( leftRank > rightRank ? leftRank : rightRank ) + 1;
+    }
+};
+
+struct WavlBalance
+{
+    static const bool HEIGHT_BALANCED = false;
+    static const int  JOIN_SLACK = 1;
+
+    /**
+     * A 0-child (rank equal to t's) is the only possible violation.
+     *  Promote t if the sibling is a 1-child, otherwise rotate it away.
+     */
+    template <typename Tree, typename Node>
+    static void afterInsert( Tree & tree, Node * & t )
+    {
+        if( t == NULL )
+            return;
+
+        int r = tree.height( t );
+        if( r == tree.height( t->left ) )
+        {
+            Node *x = t->left;
+            if( r - tree.height( t->right ) == 1 )
+                t->height++;
+            else if( x->height - tree.height( x->right ) == 2 )
+            {
+                Node *old = t;
+                tree.rotateWithLeftChild( t );
+                old->height--;
+            }
+            else
+            {
+                Node *old = t, *y = x->right;
+                tree.doubleWithLeftChild( t );
+                y->height++;
+                x->height--;
+                old->height--;
+            }
+        }
+        else if( r == tree.height( t->right ) )
+        {
+            Node *x = t->right;
+            if( r - tree.height( t->left ) == 1 )
+                t->height++;
+            else if( x->height - tree.height( x->left ) == 2 )
+            {
+                Node *old = t;
+                tree.rotateWithRightChild( t );
+                old->height--;
+            }
+            else
+            {
+                Node *old = t, *y = x->left;
+                tree.doubleWithRightChild( t );
+                y->height++;
+                x->height--;
+                old->height--;
+            }
+        }
+        tree.update( t );
+    }
+
+    /**
+     * A remove leaves either a 2,2 leaf or a 3-child below t.
+     *  Demote while the sibling allows it, otherwise rotate once and stop.
+     */
+    template <typename Tree, typename Node>
+    static void afterRemove( Tree & tree, Node * & t )
+    {
+        if( t == NULL )
+            return;
+
+        int r = tree.height( t );
+        if( t->left == NULL && t->right == NULL )
+            t->height = 0;
+        else if( r - tree.height( t->left ) == 3 )
+        {
+            Node *y = t->right;
+            if( r - y->height == 2 )
+                t->height--;
+            else if( y->height - tree.height( y->left ) == 2 &&
+                     y->height - tree.height( y->right ) == 2 )
+            {
+                t->height--;
+                y->height--;
+            }
+            else if( y->height - tree.height( y->right ) == 1 )
+            {
+                Node *old = t;
+                tree.rotateWithRightChild( t );
+                y->height++;
+                old->height--;
+                if( old->left == NULL && old->right == NULL )
+                    old->height = 0;
+            }
+            else
+            {
+                Node *old = t, *w = y->left;
+                tree.doubleWithRightChild( t );
+                w->height += 2;
+                y->height--;
+                old->height -= 2;
+            }
+        }
+        else if( r - tree.height( t->right ) == 3 )
+        {
+            Node *y = t->left;
+            if( r - y->height == 2 )
+                t->height--;
+            else if( y->height - tree.height( y->left ) == 2 &&
+                     y->height - tree.height( y->right ) == 2 )
+            {
+                t->height--;
+                y->height--;
+            }
+            else if( y->height - tree.height( y->left ) == 1 )
+            {
+                Node *old = t;
+                tree.rotateWithLeftChild( t );
+                y->height++;
+                old->height--;
+                if( old->left == NULL && old->right == NULL )
+                    old->height = 0;
+            }
+            else
+            {
+                Node *old = t, *w = y->right;
+                tree.doubleWithLeftChild( t );
+                w->height += 2;
+                y->height--;
+                old->height -= 2;
+            }
+        }
+        tree.update( t );
+    }
+
+    static int builtRank( int leftRank, int rightRank )
+    {
+        return ( leftRank > rightRank ? leftRank : rightRank ) + 1;
+    }
+};
+
+struct RedBlackBalance
+{
+    static const bool HEIGHT_BALANCED = false;
+    static const int  JOIN_SLACK = 0;
+
+    /**
+     * A red (0-)child of t with a red child is the only possible
+     *  violation. Recolor by promoting t if both children are red,
+     *  otherwise one rotation fixes it; rotations keep every rank.
+     */
+    template <typename Tree, typename Node>
+    static void afterInsert( Tree & tree, Node * & t )
+    {
+        if( t == NULL )
+            return;
+
+        int r = tree.height( t );
+        Node *x = t->left;
+        Node *s = t->right;
+        if( x != NULL && x->height == r &&
+            ( tree.height( x->left ) == r || tree.height( x->right ) == r ) )
+        {
+            if( tree.height( s ) == r )
+                t->height++;
+            else if( tree.height( x->left ) == r )
+                tree.rotateWithLeftChild( t );
+            else
+                tree.doubleWithLeftChild( t );
+        }
+        else if( s != NULL && s->height == r &&
+                 ( tree.height( s->left ) == r || tree.height( s->right ) == r ) )
+        {
+            if( tree.height( x ) == r )
+                t->height++;
+            else if( tree.height( s->right ) == r )
+                tree.rotateWithRightChild( t );
+            else
+                tree.doubleWithRightChild( t );
+        }
+        tree.update( t );
+    }
+
+    /**
+     * A remove can leave one 2-child below t (a black height deficit).
+     */
+    template <typename Tree, typename Node>
+    static void afterRemove( Tree & tree, Node * & t )
+    {
+        if( t == NULL )
+            return;
+
+        if( tree.height( t ) - tree.height( t->left ) == 2 )
+            fixLeftDeficit( tree, t );
+        else if( tree.height( t ) - tree.height( t->right ) == 2 )
+            fixRightDeficit( tree, t );
+        tree.update( t );
+    }
+
+    static int builtRank( int leftRank, int rightRank )
+    {
+        return ( leftRank < rightRank ? leftRank : rightRank ) + 1;
+    }
+
+  private:
+    template <typename Tree, typename Node>
+    static void fixLeftDeficit( Tree & tree, Node * & t )
+    {
+        int r = t->height;
+        Node *y = t->right;
+        if( y->height == r )
+        {
+            // Red sibling: rotate it up, then fix the old t one level down
+            tree.rotateWithRightChild( t );
+            fixLeftDeficit( tree, t->left );
+            tree.update( t );
+        }
+        else if( y->height - tree.height( y->left ) == 1 &&
+                 y->height - tree.height( y->right ) == 1 )
+            t->height--;
+        else if( tree.height( y->right ) == y->height )
+        {
+            Node *old = t;
+            tree.rotateWithRightChild( t );
+            y->height = r;
+            old->height = r - 1;
+        }
+        else
+        {
+            Node *old = t, *w = y->left;
+            tree.doubleWithRightChild( t );
+            w->height = r;
+            old->height = r - 1;
+        }
+    }
+
+    template <typename Tree, typename Node>
+    static void fixRightDeficit( Tree & tree, Node * & t )
+    {
+        int r = t->height;
+        Node *y = t->left;
+        if( y->height == r )
+        {
+            tree.rotateWithLeftChild( t );
+            fixRightDeficit( tree, t->right );
+            tree.update( t );
+        }
+        else if( y->height - tree.height( y->left ) == 1 &&
+                 y->height - tree.height( y->right ) == 1 )
+            t->height--;
+        else if( tree.height( y->left ) == y->height )
+        {
+            Node *old = t;
+            tree.rotateWithLeftChild( t );
+            y->height = r;
+            old->height = r - 1;
+        }
+        else
+        {
+            Node *old = t, *w = y->right;
+            tree.doubleWithLeftChild( t );
+            w->height = r;
+            old->height = r - 1;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef AVL_INTERVAL_TREE_H
+#define AVL_INTERVAL_TREE_H
+
+#include "AvlTree.h"
+#include <iostream>
+#include <utility>     // For pair
+#include <vector>
+using namespace std;
+
+// AvlIntervalTree class
+//
+// CONSTRUCTION: with no parameters
+//
+// Intervals are closed, [lo, hi], and ordered by lo then hi. Identical
+// intervals may be stored more than once (multiset mode).
+//
+// ******************PUBLIC OPERATIONS*********************
+// void insert( lo, hi )  --> Insert interval [lo, hi]
+// void remove( lo, hi )  --> Remove one occurrence of [lo, hi]
+// bool anyOverlap( lo, hi ) --> True if some interval overlaps, O(log n)
+// vector allOverlaps( lo, hi ) --> Every overlapping interval, k of them,
+//                          O(min(n, k log n)); see allOverlaps( ) below
+// vector anyOverlap( windows )  --> anyOverlap( ) for a batch of windows
+// vector allOverlaps( windows ) --> allOverlaps( ) for a batch of windows
+// ... plus everything AvlTree< Interval<T> > provides
+// ******************ERRORS********************************
+// Throws IllegalArgumentException if lo > hi, or from setLazyDeletion( ):
+//  tombstones would leave maxEnd covering removed intervals
+
+/**
+ *  Closed interval [lo, hi]. maxEnd is the largest hi in the subtree
+ *  rooted at the node holding this interval; the tree maintains it.
+ */
+template <typename T>
+struct Interval
+{
+    T lo;
+    T hi;
+    T maxEnd;
+
+    Interval( const T & l, const T & h ) : lo( l ), hi( h ), maxEnd( h ) { }
+
+    bool overlaps( const T & l, const T & h ) const
+    {
+        return !( hi < l ) && !( h < lo );
+    }
+
+    bool operator< ( const Interval & rhs ) const
+    {
+        return lo < rhs.lo || ( !( rhs.lo < lo ) && hi < rhs.hi );
+    }
+
+    bool operator> ( const Interval & rhs ) const
+    {
+        return rhs < *this;
+    }
+
+    bool operator== ( const Interval & rhs ) const
+    {
+        return !( *this < rhs ) && !( rhs < *this );
+    }
+};
+
+template <typename T>
+ostream & operator<< ( ostream & out, const Interval<T> & i )
+{
+    return out << "[" << i.lo << "," << i.hi << "]";
+}
+
+/**
+ *  Keep maxEnd current through every rotation and rebalance.
+ */
+template <typename T>
+struct AvlAugment< Interval<T> >
+{
+    static const bool ACTIVE = true;
+
+    static void update( Interval<T> & element, const Interval<T> *left,
+                        const Interval<T> *right )
+    {
+        element.maxEnd = element.hi;
+        if( left != NULL && element.maxEnd < left->maxEnd )
+            element.maxEnd = left->maxEnd;
+        if( right != NULL && element.maxEnd < right->maxEnd )
+            element.maxEnd = right->maxEnd;
+    }
+};
+
+template <typename T>
+class AvlIntervalTree : public AvlTree< Interval<T> >
+{
+  public:
+    typedef AvlTree< Interval<T> > Base;
+    typedef typename Base::AvlNode AvlNode;
+
+    AvlIntervalTree( ) : Base( true )
+    {
+    }
+
+    using Base::insert;
+    using Base::remove;
+
+    /**
+     * Insert the interval [lo, hi].
+     */
+    void insert( const T & lo, const T & hi )
+    {
+        if( hi < lo )
+            throw IllegalArgumentException( );
+        Base::insert( Interval<T>( lo, hi ) );
+    }
+
+    /**
+     * Remove one occurrence of [lo, hi]. Nothing is done if it is absent.
+     */
+    void remove( const T & lo, const T & hi )
+    {
+        Base::removeOne( Interval<T>( lo, hi ) );
+    }
+
+    /**
+     * Returns true if any stored interval overlaps [lo, hi].
+     */
+    bool anyOverlap( const T & lo, const T & hi ) const
+    {
+        AvlNode *t = this->root;
+        while( t != NULL )
+        {
+            if( t->element.overlaps( lo, hi ) )
+                return true;
+            // If the left subtree reaches lo and still has no overlap,
+            //  every interval to the right starts after hi as well.
+            if( t->left != NULL && !( t->left->element.maxEnd < lo ) )
+                t = t->left;
+            else
+                t = t->right;
+        }
+        return false;
+    }
+
+    /**
+     * Return every stored interval overlapping [lo, hi] in sorted order.
+     */
+    vector< Interval<T> > allOverlaps( const T & lo, const T & hi ) const
+    {
+        vector< Interval<T> > found;
+        allOverlaps( lo, hi, this->root, found );
+        return found;
+    }
+
+    /**
+     * anyOverlap( ) for each window in a batch.
+     */
+    vector<bool> anyOverlap( const vector< pair<T, T> > & windows ) const
+    {
+        vector<bool> result;
+        result.reserve( windows.size( ) );
+        for( auto & w : windows )
+            result.push_back( anyOverlap( w.first, w.second ) );
+        return result;
+    }
+
+    /**
+     * allOverlaps( ) for each window in a batch.
+     */
+    vector< vector< Interval<T> > > allOverlaps( const vector< pair<T, T> > & windows ) const
+    {
+        vector< vector< Interval<T> > > result( windows.size( ) );
+        for( size_t i = 0; i < windows.size( ); i++ )
+            allOverlaps( windows[i].first, windows[i].second, this->root, result[i] );
+        return result;
+    }
+
+  private:
+    /**
+     * Internal method to collect overlaps of [lo, hi] in subtree t.
+     *  Subtrees whose maxEnd is below lo, and right subtrees of nodes
+     *  starting after hi, cannot overlap and are skipped. That pruning
+     *  pays one root path per reported interval, not O(log n + k): when
+     *  the k hits are spread among intervals that miss, the walk visits
+     *  O(k log(n/k)) nodes, at worst the whole tree.
+     */
+    void allOverlaps( const T & lo, const T & hi, AvlNode *t,
+                      vector< Interval<T> > & found ) const
+    {
+        if( t == NULL || t->element.maxEnd < lo )
+            return;
+
+        allOverlaps( lo, hi, t->left, found );
+        if( hi < t->element.lo )
+            return;
+        if( t->element.overlaps( lo, hi ) )
+            for( int i = 0; i < t->count; i++ )
+                found.push_back( t->element );
+        allOverlaps( lo, hi, t->right, found );
+    }
+};
+
+#endif
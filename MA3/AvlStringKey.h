@@ -0,0 +1,327 @@
+#ifndef AVL_STRING_KEY_H
+#define AVL_STRING_KEY_H
+
+#include "AvlTree.h"
+#include <cstdint>
+#include <cstring>
+#include <functional>  // For hash
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// AvlStringKey class
+//
+// CONSTRUCTION: from a string, optionally placing its bytes in an arena
+//
+// A string key built for cheap comparisons inside AvlTree nodes. The first
+// eight bytes are packed big-endian into an integer stored inline, so most
+// comparisons on the way down the tree are a single integer compare with
+// no pointer chasing. Only when two prefixes tie are the remaining bytes
+// read. Strings of up to eight bytes need no storage beyond the key
+// itself; longer tails live on the heap, or in an AvlStringArena to avoid
+// one allocation per key. A hash of the whole string is computed once.
+//
+// For lookups, AvlStringKey::probe( s ) builds a key that borrows s's
+// bytes instead of copying them and hashes only if asked (as
+// CachedAvlTree does), so contains( ) and remove( ) allocate nothing.
+// Copies and moves of a probe own their tail, so inserting one is safe.
+//
+// Keys order exactly as std::string does (bytewise, unsigned).
+//
+// ******************PUBLIC OPERATIONS*********************
+// AvlStringKey( s )      --> Key owning a copy of s
+// AvlStringKey( s, arena ) --> Key whose tail lives in arena
+// AvlStringKey::probe( s ) --> Lookup key borrowing s; s must outlive it
+// string str( )          --> The full string
+// size_t size( )         --> Length in bytes
+// <, >, ==, <<, hash     --> As for std::string
+// AvlStringTree<>        --> AvlTree<AvlStringKey>
+// ******************ERRORS********************************
+// None
+
+/**
+ *  Bump allocator for key tails. Not thread safe; must outlive every
+ *  key (and so every tree) that points into it.
+ */
+class AvlStringArena
+{
+  public:
+    AvlStringArena( ) : used( BLOCK_SIZE ) { }
+
+    AvlStringArena( const AvlStringArena & ) = delete;
+    AvlStringArena & operator= ( const AvlStringArena & ) = delete;
+
+    /**
+     * Copy n bytes into the arena and return where they went.
+     */
+    const char * store( const char *bytes, size_t n )
+    {
+        if( n > BLOCK_SIZE / 4 )          // Big strings get their own block
+        {
+            large.push_back( unique_ptr<char[]>( new char[n] ) );
+            memcpy( large.back( ).get( ), bytes, n );
+            return large.back( ).get( );
+        }
+        if( used + n > BLOCK_SIZE )
+        {
+            blocks.push_back( unique_ptr<char[]>( new char[BLOCK_SIZE] ) );
+            used = 0;
+        }
+        char *dst = blocks.back( ).get( ) + used;
+        memcpy( dst, bytes, n );
+        used += n;
+        return dst;
+    }
+
+  private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    vector< unique_ptr<char[]> > blocks;   // Last one is the bump block
+    vector< unique_ptr<char[]> > large;
+    size_t used;
+};
+
+class AvlStringKey
+{
+  public:
+    AvlStringKey( ) : prefix( 0 ), length( 0 ), hashCode( fnv( "", 0 ) ),
+                      tail( NULL ), ownsTail( false ), borrowed( false ), hashed( true )
+    {
+    }
+
+    AvlStringKey( const string & s )
+    {
+        init( s.data( ), s.size( ), NULL );
+    }
+
+    AvlStringKey( const char *s )
+    {
+        init( s, strlen( s ), NULL );
+    }
+
+    AvlStringKey( const string & s, AvlStringArena & arena )
+    {
+        init( s.data( ), s.size( ), &arena );
+    }
+
+    /**
+     * Lookup key over the n bytes at s, borrowed rather than copied.
+     */
+    static AvlStringKey probe( const char *s, size_t n )
+    {
+        return AvlStringKey( s, n, true );     // Elided, so never copied
+    }
+
+    static AvlStringKey probe( const string & s )
+    {
+        return probe( s.data( ), s.size( ) );
+    }
+
+    /**
+     * Copies own a heap tail where the source owned or borrowed one.
+     */
+    AvlStringKey( const AvlStringKey & other )
+      : prefix( other.prefix ), length( other.length ), hashCode( other.hashValue( ) ),
+        tail( other.tail ), ownsTail( other.tail != NULL && ( other.ownsTail || other.borrowed ) ),
+        borrowed( false ), hashed( true )
+    {
+        if( ownsTail )
+            tail = copyTail( other.tail, length - PREFIX_BYTES );
+    }
+
+    AvlStringKey( AvlStringKey && other )
+      : prefix( other.prefix ), length( other.length ), hashCode( other.hashValue( ) ),
+        tail( other.tail ), ownsTail( other.ownsTail ), borrowed( false ), hashed( true )
+    {
+        if( other.borrowed && tail != NULL )
+        {
+            tail = copyTail( other.tail, length - PREFIX_BYTES );
+            ownsTail = true;
+        }
+        other.ownsTail = false;
+    }
+
+    AvlStringKey & operator= ( AvlStringKey other )
+    {
+        swap( prefix, other.prefix );
+        swap( length, other.length );
+        swap( hashCode, other.hashCode );
+        swap( tail, other.tail );
+        swap( ownsTail, other.ownsTail );
+        swap( borrowed, other.borrowed );
+        swap( hashed, other.hashed );
+        return *this;
+    }
+
+    ~AvlStringKey( )
+    {
+        if( ownsTail )
+            delete [] tail;
+    }
+
+    /**
+     * Return the full string.
+     */
+    string str( ) const
+    {
+        string s;
+        s.reserve( length );
+        for( size_t i = 0; i < length && i < PREFIX_BYTES; i++ )
+            s.push_back( char( prefix >> ( 56 - 8 * i ) ) );
+        if( length > PREFIX_BYTES )
+            s.append( tail, length - PREFIX_BYTES );
+        return s;
+    }
+
+    size_t size( ) const
+    {
+        return length;
+    }
+
+    /**
+     * FNV-1a of the whole string; a probe computes it on first use.
+     */
+    size_t hashValue( ) const
+    {
+        if( !hashed )
+        {
+            uint8_t head[ PREFIX_BYTES ];
+            for( size_t i = 0; i < PREFIX_BYTES; i++ )
+                head[i] = uint8_t( prefix >> ( 56 - 8 * i ) );
+            uint32_t h = fnv( reinterpret_cast<const char *>( head ),
+                              length < PREFIX_BYTES ? length : PREFIX_BYTES );
+            if( length > PREFIX_BYTES )
+                h = fnv( tail, length - PREFIX_BYTES, h );
+            hashCode = h;
+            hashed = true;
+        }
+        return hashCode;
+    }
+
+    /**
+     * Bytewise order: the inline prefix decides unless it ties.
+     */
+    bool operator< ( const AvlStringKey & rhs ) const
+    {
+        if( prefix != rhs.prefix )
+            return prefix < rhs.prefix;
+        return compareTails( rhs ) < 0;
+    }
+
+    bool operator> ( const AvlStringKey & rhs ) const
+    {
+        return rhs < *this;
+    }
+
+    bool operator== ( const AvlStringKey & rhs ) const
+    {
+        return prefix == rhs.prefix && length == rhs.length && compareTails( rhs ) == 0;
+    }
+
+  private:
+    static const size_t PREFIX_BYTES = sizeof( uint64_t );
+
+    uint64_t    prefix;       // First 8 bytes, big-endian, zero padded
+    uint32_t    length;
+    mutable uint32_t hashCode; // FNV-1a of the whole string, once hashed
+    const char *tail;         // Bytes past the prefix, NULL if none
+    bool        ownsTail;     // tail came from new[] rather than an arena
+    bool        borrowed;     // tail belongs to the caller (a probe)
+    mutable bool hashed;      // Probes hash lazily; stored keys never do
+
+    /**
+     * Probe over borrowed bytes; see probe( ).
+     */
+    AvlStringKey( const char *s, size_t n, bool /* borrow */ )
+      : prefix( packPrefix( s, n ) ), length( n ), hashCode( 0 ),
+        tail( n > PREFIX_BYTES ? s + PREFIX_BYTES : NULL ), ownsTail( false ),
+        borrowed( true ), hashed( false )
+    {
+    }
+
+    static uint64_t packPrefix( const char *s, size_t n )
+    {
+        uint64_t packed = 0;
+        for( size_t i = 0; i < PREFIX_BYTES; i++ )
+            packed = ( packed << 8 ) | ( i < n ? uint8_t( s[i] ) : 0 );
+        return packed;
+    }
+
+    void init( const char *s, size_t n, AvlStringArena *arena )
+    {
+        length = n;
+        hashCode = fnv( s, n );
+        hashed = true;
+        prefix = packPrefix( s, n );
+
+        tail = NULL;
+        ownsTail = false;
+        borrowed = false;
+        if( n > PREFIX_BYTES )
+        {
+            if( arena != NULL )
+                tail = arena->store( s + PREFIX_BYTES, n - PREFIX_BYTES );
+            else
+            {
+                tail = copyTail( s + PREFIX_BYTES, n - PREFIX_BYTES );
+                ownsTail = true;
+            }
+        }
+    }
+
+    static const char * copyTail( const char *bytes, size_t n )
+    {
+        char *copy = new char[n];
+        memcpy( copy, bytes, n );
+        return copy;
+    }
+
+    static uint32_t fnv( const char *p, size_t n, uint32_t h = 2166136261u )
+    {
+        for( size_t i = 0; i < n; i++ )
+            h = ( h ^ uint8_t( p[i] ) ) * 16777619u;
+        return h;
+    }
+
+    /**
+     * Compare everything past equal prefixes. Zero padding makes "ab"
+     *  and "ab\0" share a prefix, so length breaks the final tie.
+     */
+    int compareTails( const AvlStringKey & rhs ) const
+    {
+        size_t lhsTail = length > PREFIX_BYTES ? length - PREFIX_BYTES : 0;
+        size_t rhsTail = rhs.length > PREFIX_BYTES ? rhs.length - PREFIX_BYTES : 0;
+        size_t common = lhsTail < rhsTail ? lhsTail : rhsTail;
+        if( common > 0 )
+        {
+            int c = memcmp( tail, rhs.tail, common );
+            if( c != 0 )
+                return c;
+        }
+        return length < rhs.length ? -1 : ( length > rhs.length ? 1 : 0 );
+    }
+};
+
+inline ostream & operator<< ( ostream & out, const AvlStringKey & key )
+{
+    return out << key.str( );
+}
+
+namespace std
+{
+    template <>
+    struct hash<AvlStringKey>
+    {
+        size_t operator( ) ( const AvlStringKey & key ) const
+        {
+            return key.hashValue( );
+        }
+    };
+}
+
+template <typename Balance = AvlBalance>
+using AvlStringTree = AvlTree<AvlStringKey, Balance>;
+
+#endif
@@ -2,16 +2,30 @@
 #define AVL_TREE_H
 
 #include "dsexceptions.h"
+#include "AvlBalance.h"
 #include <iostream>    // For NULL
 #include <queue>       // For level order printout
 #include <vector>
 #include <algorithm>   // For max() function
+#include <condition_variable>
+#include <deque>
+#include <functional>  // For deferred destruction jobs
+#include <future>      // For parallel clone and traversal
+#include <memory>
+#include <mutex>
+#include <new>         // For placement new into node arenas
+#include <thread>
+#include <pthread.h>   // For the reclaimer's scheduling class
 using namespace std;
 
 // AvlTree class
 //
 // CONSTRUCTION: with ITEM_NOT_FOUND object used to signal failed finds
 //
+// The Balance template parameter picks the rebalancing rule (see
+// AvlBalance.h): AvlBalance (default), WavlBalance or RedBlackBalance.
+// All three share this interface.
+//
 // ******************PUBLIC OPERATIONS*********************
 // Programming Assignment Part I
 // bool empty( )          --> Test for empty tree @ root
@@ -21,6 +35,7 @@ using namespace std;
 // void insert( vector<T> ) --> Insert whole vector of values
 // void remove( x )       --> -fdbsaq	x (unimplemented)
 // bool contains( x )     --> Return true if x is present
+// unsigned long version( ) --> Changes whenever the tree is modified
 // Comparable findMin( )  --> Return smallest item
 // Comparable findMax( )  --> Return largest item
 // boolean isEmpty( )     --> Return true if empty; else false
@@ -37,25 +52,213 @@ using namespace std;
 // AvlTree &operator= ( AvlTree & other ) --> Big Five Copy *assignment* operator
 // AvlTree &operator= ( AvlTree && other ) --> Big Five Move *assignment* operator
 // void printLevelOrder( ) --> Print tree in LEVEL order :-)
+
+// Multiset mode (construct with AvlTree( true ))
+// int count( x )         --> Number of occurrences of x
+// void removeOne( x )    --> Remove a single occurrence of x
+// void removeAll( x )    --> Remove every occurrence of x
+// Comparable findKth( k ) --> Return k-th smallest item (0-based, weighted)
+// int rank( x )          --> Number of items strictly less than x
+
+// Bulk structure operations
+// void split( x, greater ) --> Move every item >= x into (empty) greater
+// void join( greater )   --> Append greater (all items > ours); empties it
+// void forEach( f )      --> Call f( item ) for each item in sorted order
+// void forEachInRange( lo, hi, f ) --> Same, restricted to lo <= item <= hi
+// int removeRange( lo, hi ) --> Remove every item in [lo, hi], O(log n + k)
+// int removeIf( pred )   --> Remove every item with pred( item ), O(n)
+// void assignSorted( first, last ) --> Replace contents with sorted items, O(n)
+
+// Parallel operations (large trees fork subtrees onto worker threads)
+// AvlTree( const AvlTree & ) --> Big trees are cloned in parallel into arenas
+// void parallelForEach( f ) --> Call f( item ) concurrently, any order
+// T parallelReduce( id, map, combine ) --> Combine map( item ) over all items
+
+// Deferred destruction (opt in per tree)
+// void setDeferredDestruction( on ) --> makeEmpty, assignment and the
+//                          destructor detach big node graphs in O(1) and
+//                          free them on the AvlReclaimer thread
+// bool deferredDestruction( ) --> Whether this tree defers
+
+// Lazy deletion (opt in per tree)
+// void setLazyDeletion( f ) --> remove/removeOne/removeAll only mark the
+//                          node a tombstone (count 0) in O(log n), with no
+//                          rotations; the tree is rebuilt once tombstones
+//                          exceed fraction f of size( ) + tombstones. f <= 0
+//                          turns it off (compacting first)
+// double lazyDeletion( ) --> The fraction, 0 when off
+// int tombstoneCount( )  --> Tombstones currently in the tree
+// void compact( )        --> Rebuild now without tombstones, O(n)
 // ******************ERRORS********************************
 // Throws UnderflowException as warranted
-
+// Throws IllegalArgumentException if join( ) operands overlap,
+//  assignSorted( ) input is out of order, or lazy deletion is turned on
+//  for an augmented element type
+
+/**
+ *  Per-node augmentation hook. update( ) is called whenever a node's
+ *  children change (balance and rotations) with the elements of its
+ *  children, or NULL. Specialize to keep subtree summaries inside the
+ *  element (see AvlIntervalTree.h); the default does nothing.
+ *  Specializations set ACTIVE, which turns off features that would keep
+ *  dead elements in the summaries (lazy deletion).
+ */
 template <typename Comparable>
+struct AvlAugment
+{
+    static const bool ACTIVE = false;
+
+    static void update( Comparable & /* element */, const Comparable * /* left */,
+                        const Comparable * /* right */ ) { }
+};
+
+/**
+ *  Process-wide background thread that frees node graphs detached by
+ *  trees in deferred destruction mode, so a request thread replacing a
+ *  huge tree does not stall while its nodes are freed. Jobs run one at a
+ *  time in the order they were handed over.
+ *
+ *  The thread runs at idle priority, so on a busy machine it may fall
+ *  behind. The queue is bounded by jobs and by the items they hold; once
+ *  full, defer( ) refuses and the tree frees the graph itself, which
+ *  keeps memory bounded at the cost of a caller-side stall.
+ *
+ *  The instance is never destroyed: trees may still hand over work while
+ *  statics are torn down. Work still queued at exit is simply dropped,
+ *  and the OS takes the memory back.
+ */
+class AvlReclaimer
+{
+  public:
+    static AvlReclaimer & instance( )
+    {
+        static AvlReclaimer *reclaimer = new AvlReclaimer( );
+        return *reclaimer;
+    }
+
+    static const size_t MAX_JOBS = 64;
+    static const size_t MAX_ITEMS = size_t( 1 ) << 22;
+
+    /**
+     * Queue job, which frees about items items; starts the thread on
+     *  first use. Returns false, queuing nothing, if the queue is full.
+     */
+    bool defer( function<void( )> job, size_t items )
+    {
+        lock_guard<mutex> guard( lock );
+        if( !jobs.empty( ) && ( jobs.size( ) >= MAX_JOBS || pendingItems + items > MAX_ITEMS ) )
+            return false;
+        if( !started )
+        {
+            thread( [ this ]( ) { run( ); } ).detach( );
+            started = true;
+        }
+        jobs.emplace_back( std::move( job ), items );
+        pendingItems += items;
+        wake.notify_one( );
+        return true;
+    }
+
+    /**
+     * Block until every job queued so far has finished.
+     */
+    void drain( )
+    {
+        unique_lock<mutex> guard( lock );
+        idle.wait( guard, [ this ]( ) { return jobs.empty( ) && !busy; } );
+    }
+
+    /**
+     * Number of jobs queued and not yet started.
+     */
+    size_t pending( )
+    {
+        lock_guard<mutex> guard( lock );
+        return jobs.size( );
+    }
+
+    /**
+     * Number of jobs finished so far.
+     */
+    unsigned long completed( )
+    {
+        lock_guard<mutex> guard( lock );
+        return done;
+    }
+
+  private:
+    mutex lock;
+    condition_variable wake;
+    condition_variable idle;
+    deque< pair<function<void( )>, size_t> > jobs;
+    size_t pendingItems = 0;           // Items held by queued jobs
+    bool started = false;
+    bool busy = false;
+    unsigned long done = 0;
+
+    AvlReclaimer( ) { }
+
+    /**
+     * Where the OS allows it, only run when a CPU would otherwise idle, so
+     *  that freeing never preempts the threads it is offloading.
+     */
+    void run( )
+    {
+#ifdef SCHED_IDLE
+        sched_param idlePriority = { };
+        pthread_setschedparam( pthread_self( ), SCHED_IDLE, &idlePriority );
+#endif
+        unique_lock<mutex> guard( lock );
+        for( ;; )
+        {
+            wake.wait( guard, [ this ]( ) { return !jobs.empty( ); } );
+            function<void( )> job = std::move( jobs.front( ).first );
+            size_t items = jobs.front( ).second;
+            jobs.pop_front( );
+            busy = true;
+            guard.unlock( );
+            job( );
+            job = nullptr;     // Free whatever the job captured off the lock
+            guard.lock( );
+            pendingItems -= items;
+            busy = false;
+            done++;
+            if( jobs.empty( ) )
+                idle.notify_all( );
+        }
+    }
+};
+
+template <typename Comparable, typename Balance = AvlBalance>
 class AvlTree
 {
+    friend Balance;
+
   public:
     /**
      *  Basic constructor for an empty tree
      */
-    AvlTree( ) : root( NULL )
+    AvlTree( ) : root( NULL ), multiset( false ), modifications( 0 ), deferFree( false ),
+                 lazyFraction( 0 ), tombstones( 0 )
     {
         //cout << " [d] AvlTree constructor called. " << endl;
     }
 
+    /**
+     *  Empty tree; duplicates are counted in each node when isMultiset
+     */
+    explicit AvlTree( bool isMultiset )
+      : root( NULL ), multiset( isMultiset ), modifications( 0 ), deferFree( false ),
+        lazyFraction( 0 ), tombstones( 0 )
+    {
+    }
+
     /**
      *  Vector of data initializer (needed for move= operator rvalue)
      */
-    AvlTree( vector<Comparable> vals ) : root( NULL )
+    AvlTree( vector<Comparable> vals )
+      : root( NULL ), multiset( false ), modifications( 0 ), deferFree( false ),
+        lazyFraction( 0 ), tombstones( 0 )
     {
         insert(vals);
     }
@@ -78,9 +281,11 @@ class AvlTree
     /**
      * Copy other to new object - Big Five Copy Constructor
      */
-    AvlTree( const AvlTree &other ) : root( NULL )
+    AvlTree( const AvlTree &other )
+      : root( NULL ), multiset( other.multiset ), modifications( 0 ), deferFree( other.deferFree ),
+        lazyFraction( other.lazyFraction ), tombstones( other.tombstones )
     {
-		root = clone(other.root);
+		root = copyNodes(other.root);
         cout << " [d] Copy Constructor Called." << endl;
         // Copy contents of other to ourselves (maybe clone?)
         // Get a deep copy of other's tree
@@ -89,10 +294,15 @@ class AvlTree
     /**
      * Move other's tree to new object - Big Five Move Constructor
      */
-    AvlTree( AvlTree &&other ) : root( NULL )
+    AvlTree( AvlTree &&other )
+      : root( NULL ), multiset( other.multiset ), modifications( 0 ), deferFree( other.deferFree ),
+        lazyFraction( other.lazyFraction ), tombstones( other.tombstones )
     {
 		root = other.root;
+		arenas.swap(other.arenas);
 		other.root = nullptr;
+		other.tombstones = 0;
+		other.modifications++;
         cout << " [d] Move Constructor Called." << endl;
         // *MOVE* the other's tree to us
         // Don't let other have the tree anymore (MINE!)
@@ -106,7 +316,10 @@ class AvlTree
 		if (this != &other)
 		{
 			makeEmpty();
-			root = clone(other.root);
+			root = copyNodes(other.root);
+			multiset = other.multiset;
+			lazyFraction = other.lazyFraction;    // Tombstones need the mode
+			tombstones = other.tombstones;
 		}
         cout << " [d] Copy Assignment Operator Called." << endl;
         // Ensure we're not copying ourselves
@@ -125,7 +338,13 @@ class AvlTree
 		{
 			makeEmpty();
 			root = other.root;
+			multiset = other.multiset;
+			lazyFraction = other.lazyFraction;
+			tombstones = other.tombstones;
+			arenas.swap(other.arenas);
 			other.root = nullptr;
+			other.tombstones = 0;
+			other.modifications++;
 		}
         cout << " [d] Move Assignment Operator Called." << endl;
         // Don't move ourselves into ourselves
@@ -139,10 +358,86 @@ class AvlTree
 
     /**
      * Make the tree logically empty. - Helper function!
+     *  In deferred destruction mode a big tree is detached in O(1),
+     *  together with the arenas its nodes live in, and freed later on
+     *  the AvlReclaimer thread, unless its queue is full.
      */
     void makeEmpty( )
     {
+        modifications++;
+        tombstones = 0;
+        if( deferFree && size( root ) >= DEFER_MIN_SIZE )
+        {
+            AvlNode *graph = root;
+            vector< shared_ptr<NodeArena> > blocks = arenas;
+            if( AvlReclaimer::instance( ).defer(
+                    [ graph, blocks ]( ) mutable { makeEmpty( graph ); blocks.clear( ); },
+                    size( root ) ) )
+            {
+                root = NULL;
+                arenas.clear( );
+                return;
+            }
+        }
         makeEmpty( root );
+        arenas.clear( );     // Every arena node is gone; release the blocks
+    }
+
+    /**
+     * Opt in to (or out of) freeing big trees on the reclaimer thread.
+     *  Element destructors then run on that thread. The setting is copied
+     *  and moved with construction, but not with assignment: it belongs
+     *  to the object that will be holding and replacing trees.
+     */
+    void setDeferredDestruction( bool on )
+    {
+        deferFree = on;
+    }
+
+    bool deferredDestruction( ) const
+    {
+        return deferFree;
+    }
+
+    /**
+     * Opt in to lazy deletion: removals leave tombstones, and the tree is
+     *  rebuilt in O(n) once they exceed fraction of size( ) + tombstones,
+     *  so each removal costs O(log n + 1 / fraction) amortized. In a set
+     *  that bounds the share of dead nodes by fraction; in a multiset live
+     *  nodes count once per occurrence, so dead nodes may take a larger
+     *  share. fraction <= 0 turns it off. Augmented trees (AvlAugment)
+     *  throw IllegalArgumentException: their summaries would still count
+     *  tombstoned elements.
+     */
+    void setLazyDeletion( double fraction )
+    {
+        if( fraction > 0 && AvlAugment<Comparable>::ACTIVE )
+            throw IllegalArgumentException( );
+        if( fraction <= 0 )
+        {
+            compact( );
+            fraction = 0;
+        }
+        lazyFraction = fraction;
+    }
+
+    double lazyDeletion( ) const
+    {
+        return lazyFraction;
+    }
+
+    int tombstoneCount( ) const
+    {
+        return tombstones;
+    }
+
+    /**
+     * Rebuild the tree without its tombstones: O(n), perfectly balanced.
+     */
+    void compact( )
+    {
+        if( tombstones > 0 )
+            removeIf( []( const Comparable & ) { return false; } );
     }
 
 // END AVL TREES PART II
@@ -156,6 +451,8 @@ class AvlTree
     {
         if( isEmpty( ) )
             throw UnderflowException( );
+        if( tombstones > 0 )
+            return findKth( 0, root )->element;
         return findMin( root )->element;
     }
 
@@ -167,6 +464,8 @@ class AvlTree
     {
         if( isEmpty( ) )
             throw UnderflowException( );
+        if( tombstones > 0 )
+            return findKth( size( ) - 1, root )->element;
         return findMax( root )->element;
     }
 
@@ -184,24 +483,71 @@ class AvlTree
      */
     bool isEmpty( ) const
     {
-        return root == NULL;
+        return size( root ) == 0;    // The root may be a tombstone
     }
 
     /**
      * Return number of elements in tree.
+     *  In multiset mode every occurrence is counted.
      */
-    int size( )
+    int size( ) const
     {
       return size( root );
     }
 
+    /**
+     * Return number of occurrences of x (0 or 1 unless multiset).
+     */
+    int count( const Comparable & x ) const
+    {
+        AvlNode *t = find( x, root );
+        return t == NULL ? 0 : t->count;
+    }
+
+    /**
+     * Return the k-th smallest item, counting from 0.
+     *  Duplicates in a multiset occupy count consecutive positions.
+     * Throw ArrayIndexOutOfBoundsException if k is not in [0, size).
+     */
+    const Comparable & findKth( int k ) const
+    {
+        if( k < 0 || k >= size( ) )
+            throw ArrayIndexOutOfBoundsException( );
+        return findKth( k, root )->element;
+    }
+
+    /**
+     * Return the number of items strictly less than x.
+     */
+    int rank( const Comparable & x ) const
+    {
+        return rank( x, root );
+    }
+
+    /**
+     * Return a counter that changes whenever the tree is modified.
+     *  Lets caches layered on top notice changes they did not make.
+     */
+    unsigned long version( ) const
+    {
+        return modifications;
+    }
+
+    /**
+     * Test if the tree counts duplicates instead of ignoring them.
+     */
+    bool isMultiset( ) const
+    {
+        return multiset;
+    }
+
     /**
      * Return height of tree.
      *  Null nodes are height -1
      */
-    int height( )
+    int height( ) const
     {
-      return height( root );
+      return treeHeight( root );
     }
 
     /**
@@ -264,15 +610,16 @@ class AvlTree
      */
     bool empty( )
     {
-      return( root == NULL );
+      return( isEmpty( ) );
     }
 
 
     /**
-     * Insert x into the tree; duplicates are ignored.
+     * Insert x into the tree; duplicates are ignored (counted if multiset).
      */
     void insert( const Comparable & x )
     {
+        modifications++;
         insert( x, root );
     }
 
@@ -281,6 +628,7 @@ class AvlTree
      */
     void insert( vector<Comparable> vals)
     {
+      modifications++;
       for( auto x : vals ) {
         insert( x, root );
       }
@@ -288,41 +636,258 @@ class AvlTree
      
     /**
      * Remove x from the tree. Nothing is done if x is not found.
+     *  In multiset mode every occurrence of x is removed.
      */
     void remove( const Comparable & x )
     {
-      remove( x, root );
+      modifications++;
+      if( lazyFraction > 0 )
+        removeLazily( x, -1 );
+      else
+        remove( x, root );
+    }
+
+    /**
+     * Remove a single occurrence of x; the node goes once its count is 0.
+     */
+    void removeOne( const Comparable & x )
+    {
+      modifications++;
+      if( lazyFraction > 0 )
+        removeLazily( x, 1 );
+      else
+        removeOne( x, root );
+    }
+
+    /**
+     * Remove every occurrence of x.
+     */
+    void removeAll( const Comparable & x )
+    {
+      remove( x );
+    }
+
+    /**
+     * Move every item >= x into greater, which is emptied first.
+     *  O(log n): the tree is cut along the search path for x.
+     */
+    void split( const Comparable & x, AvlTree & greater )
+    {
+        if( &greater == this )
+            return;
+        compact( );     // Tombstones could not be counted per half
+        greater.makeEmpty( );
+        greater.multiset = multiset;
+        greater.lazyFraction = lazyFraction;
+        greater.arenas = arenas;    // Both halves may hold arena nodes
+        modifications++;
+        AvlNode *t = root;
+        split( x, false, t, root, greater.root );
+    }
+
+    /**
+     * Replace the contents with the items in [first, last), which must
+     *  be in ascending order. Equal neighbours are counted in multiset
+     *  mode and dropped otherwise. The tree is linked directly into
+     *  perfect balance: O(n), no searches or rotations.
+     * Throw IllegalArgumentException if the input is out of order.
+     */
+    template <typename Iterator>
+    void assignSorted( Iterator first, Iterator last )
+    {
+        makeEmpty( );
+        vector<AvlNode *> nodes;
+        for( ; first != last; ++first )
+        {
+            if( nodes.empty( ) || nodes.back( )->element < *first )
+                nodes.push_back( new AvlNode( *first, NULL, NULL ) );
+            else if( *first < nodes.back( )->element )
+            {
+                for( AvlNode *t : nodes )
+                    freeNode( t );
+                throw IllegalArgumentException( );
+            }
+            else if( multiset )
+                nodes.back( )->count++;
+        }
+        root = buildBalanced( nodes, 0, nodes.size( ) );
+    }
+
+    /**
+     * Remove every item x with lo <= x <= hi; return how many went.
+     *  The range is cut out with two splits, freed, and the two ends
+     *  joined back: O(log n) plus the cost of freeing the k items.
+     */
+    int removeRange( const Comparable & lo, const Comparable & hi )
+    {
+        if( hi < lo )
+            return 0;
+
+        compact( );     // Else the cut-out range could hide tombstones
+        modifications++;
+        AvlNode *less, *middle, *greater;
+        split( lo, false, root, less, middle );
+        split( hi, true, middle, middle, greater );
+        int removed = size( middle );
+        makeEmpty( middle );
+        root = join( less, greater );
+        return removed;
+    }
+
+    /**
+     * Remove every item for which pred( x ) is true; return how many
+     *  went. One in-order pass frees the matches and the survivors are
+     *  relinked into a perfectly balanced tree: O(n), no searches.
+     */
+    template <typename Predicate>
+    int removeIf( Predicate pred )
+    {
+        int before = size( );
+        modifications++;
+        vector<AvlNode *> kept;
+        kept.reserve( multiset ? countNodes( root ) : size( ) );   // Live nodes
+        removeIf( root, pred, kept );
+        tombstones = 0;
+        root = buildBalanced( kept, 0, kept.size( ) );
+        return before - size( );
+    }
+
+    /**
+     * Append every item of greater to this tree and empty greater.
+     *  Every item of greater must be larger than every item here.
+     *  O(log n) in the heights of the two trees.
+     * Throw IllegalArgumentException if the trees overlap.
+     */
+    void join( AvlTree & greater )
+    {
+        if( &greater == this || greater.isEmpty( ) )
+            return;
+        if( !isEmpty( ) && !( findMax( ) < greater.findMin( ) ) )
+            throw IllegalArgumentException( );
+
+        compact( );
+        greater.compact( );
+        root = join( root, greater.root );
+        greater.root = NULL;
+        modifications++;
+        greater.modifications++;
+        arenas.insert( arenas.end( ), greater.arenas.begin( ), greater.arenas.end( ) );
+        greater.arenas.clear( );
+    }
+
+    /**
+     * Call f( x ) for every item in sorted order, once per occurrence.
+     */
+    template <typename Func>
+    void forEach( Func f ) const
+    {
+        forEach( root, f );
+    }
+
+    /**
+     * Call f( x ) in sorted order for every item with lo <= x <= hi.
+     */
+    template <typename Func>
+    void forEachInRange( const Comparable & lo, const Comparable & hi, Func f ) const
+    {
+        forEachInRange( lo, hi, root, f );
+    }
+
+    /**
+     * Call f( x ) for every item, once per occurrence, from several
+     *  threads at once on disjoint subtrees. Order is unspecified and
+     *  f must be safe to call concurrently. The tree must not change
+     *  while this runs.
+     */
+    template <typename Func>
+    void parallelForEach( Func f ) const
+    {
+        parallelForEach( root, forkDepth( root ), f );
+    }
+
+    /**
+     * Reduce the tree in parallel: combine( ) the map( x ) of every
+     *  item, once per occurrence, starting from identity. combine must
+     *  be associative; each thread folds its own subtree.
+     */
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce( T identity, Map map, Combine combine ) const
+    {
+        return parallelReduce( root, forkDepth( root ), identity, map, combine );
     }
 
 
 /*****************************************************************************/
 
-  private:
+  protected:
     struct AvlNode
     {
         Comparable element;
         AvlNode   *left;
         AvlNode   *right;
         int       height;
+        int       count;     // Occurrences of element (always 1 unless multiset)
+        int       weight;    // Sum of count over this subtree
+        bool      pooled;    // Lives in a NodeArena rather than on the heap
 
         AvlNode( const Comparable & theElement, AvlNode *lt,
-                                                AvlNode *rt, int h = 0 )
-          : element( theElement ), left( lt ), right( rt ), height( h ) { }
+                                                AvlNode *rt, int h = 0, int c = 1 )
+          : element( theElement ), left( lt ), right( rt ), height( h ),
+            count( c ), weight( c ), pooled( false ) { }
+    };
+
+    /**
+     * One contiguous block of node slots, filled by a parallel clone.
+     *  Nodes are destroyed individually; the block itself is released
+     *  when the last tree holding nodes from it lets go.
+     */
+    struct NodeArena
+    {
+        AvlNode *slots;
+
+        explicit NodeArena( size_t n )
+          : slots( static_cast<AvlNode *>( ::operator new( n * sizeof( AvlNode ) ) ) ) { }
+        ~NodeArena( ) { ::operator delete( slots ); }
+
+        NodeArena( const NodeArena & ) = delete;
+        NodeArena & operator= ( const NodeArena & ) = delete;
     };
 
+    // Trees smaller than this are copied with the plain recursive clone
+    static const int PARALLEL_MIN_SIZE = 1 << 15;
+
+    // Trees smaller than this are freed in place even when deferring
+    static const int DEFER_MIN_SIZE = 1 << 10;
+
     AvlNode *root;
+    bool     multiset;
+    unsigned long modifications;              // Bumped by every mutator
+    vector< shared_ptr<NodeArena> > arenas;   // Blocks our pooled nodes live in
+    bool     deferFree;                       // Hand big graphs to AvlReclaimer
+    double   lazyFraction;                    // Lazy deletion when > 0
+    int      tombstones;                      // Nodes with count 0
 
     /**
-     * Internal method to count nodes in tree
+     * Internal method to count elements in tree t.
+     *  Every node caches the weight of its subtree, so this is O(1).
      */
-    int size( AvlNode * & t )
+    int size( AvlNode *t ) const
     {
-			return( (t == NULL) ? 0 : size( t->left ) + size( t->right ) + 1 );
-/*
-      if( t == NULL )
-        return(0);
-      return( size( t->right, count ) + size( t->left, count ) + 1 );
-*/
+        return t == NULL ? 0 : t->weight;
+    }
+
+    /**
+     * Recompute the cached weight and augmentation of t from its
+     *  children, and its height when the policy ranks by height.
+     */
+    void update( AvlNode *t )
+    {
+        if( Balance::HEIGHT_BALANCED )
+            t->height = max( height( t->left ), height( t->right ) ) + 1;
+        t->weight = size( t->left ) + size( t->right ) + t->count;
+        AvlAugment<Comparable>::update( t->element,
+                                        t->left ? &t->left->element : NULL,
+                                        t->right ? &t->right->element : NULL );
     }
 
     /**
@@ -339,8 +904,15 @@ class AvlTree
             insert(x, t->left);
         else if( x > t->element )
             insert(x, t->right);
+        else if( t->count == 0 )
+        {
+            t->count = 1;   // Revive a tombstone in place
+            tombstones--;
+        }
+        else if( multiset )
+            ++t->count;     // Same node, same shape: no rotation needed
 
-        balance(t);
+        Balance::afterInsert( *this, t );
     }
 
     void balance( AvlNode * & t )
@@ -364,7 +936,7 @@ class AvlTree
                 doubleWithRightChild( t );
         }
 
-        t->height = max( height( t->left ), height( t->right ) ) + 1;
+        update( t );
     }
 
     /**
@@ -381,17 +953,291 @@ class AvlTree
             remove( x, t->right );
         else if( t->left != NULL && t->right != NULL ) // Two children
         {
-            t->element = findMin( t->right )->element;
+            AvlNode *successor = findMin( t->right );
+            t->element = successor->element;
+            t->count = successor->count;
             remove( t->element, t->right );
         }
         else
         {
             AvlNode *oldNode = t;
             t = ( t->left != NULL ) ? t->left : t->right;
-            delete oldNode;
+            freeNode( oldNode );
         }
 
-        balance( t );
+        Balance::afterRemove( *this, t );
+    }
+
+    /**
+     *  Remove one occurrence of x from tree t
+     */
+    void removeOne( const Comparable & x, AvlNode * & t )
+    {
+        if( t == NULL )
+            return;
+
+        if( x < t->element )
+            removeOne( x, t->left );
+        else if( t->element < x )
+            removeOne( x, t->right );
+        else if( t->count > 1 )
+            --t->count;
+        else
+        {
+            remove( x, t );
+            return;
+        }
+
+        Balance::afterRemove( *this, t );
+    }
+
+    /**
+     * Internal method to find the node holding x in subtree t.
+     * Return NULL if x is not present.
+     */
+    AvlNode * find( const Comparable & x, AvlNode *t ) const
+    {
+        while( t != NULL )
+            if( x < t->element )
+                t = t->left;
+            else if( t->element < x )
+                t = t->right;
+            else
+                return t;    // Match
+
+        return NULL;   // No match
+    }
+
+    /**
+     * Internal method to find the node holding the k-th smallest item.
+     *  k must be in [0, size( t )).
+     */
+    AvlNode * findKth( int k, AvlNode *t ) const
+    {
+        for( ;; )
+        {
+            int leftSize = size( t->left );
+            if( k < leftSize )
+                t = t->left;
+            else if( k < leftSize + t->count )
+                return t;
+            else
+            {
+                k -= leftSize + t->count;
+                t = t->right;
+            }
+        }
+    }
+
+    /**
+     * Internal method to count items strictly less than x in subtree t.
+     */
+    int rank( const Comparable & x, AvlNode *t ) const
+    {
+        int less = 0;
+        while( t != NULL )
+            if( x < t->element )
+                t = t->left;
+            else if( t->element < x )
+            {
+                less += size( t->left ) + t->count;
+                t = t->right;
+            }
+            else
+                return less + size( t->left );
+
+        return less;
+    }
+
+    /**
+     * Internal method to join l, the single node k and r into one tree,
+     *  where every item of l < k < every item of r.
+     *  Descend the taller side until the ranks are within the policy's
+     *  JOIN_SLACK, hang k there, then fix back up as after an insert.
+     *  Return the new root.
+     */
+    AvlNode * join( AvlNode *l, AvlNode *k, AvlNode *r )
+    {
+        if( height( l ) > height( r ) + Balance::JOIN_SLACK )
+        {
+            l->right = join( l->right, k, r );
+            Balance::afterInsert( *this, l );
+            return l;
+        }
+        if( height( r ) > height( l ) + Balance::JOIN_SLACK )
+        {
+            r->left = join( l, k, r->left );
+            Balance::afterInsert( *this, r );
+            return r;
+        }
+        k->left = l;
+        k->right = r;
+        k->height = max( height( l ), height( r ) ) + 1;
+        update( k );
+        return k;
+    }
+
+    /**
+     * Internal method to split subtree t around x.
+     *  Items < x end up in less, items > x in greater; items equal to
+     *  x go to less if keepEqual, otherwise to greater.
+     */
+    void split( const Comparable & x, bool keepEqual, AvlNode *t,
+                AvlNode * & less, AvlNode * & greater )
+    {
+        if( t == NULL )
+        {
+            less = greater = NULL;
+            return;
+        }
+
+        AvlNode *l = t->left;
+        AvlNode *r = t->right;
+        if( t->element < x || ( keepEqual && !( x < t->element ) ) )
+        {
+            AvlNode *mid;
+            split( x, keepEqual, r, mid, greater );
+            less = join( l, t, mid );
+        }
+        else
+        {
+            AvlNode *mid;
+            split( x, keepEqual, l, less, mid );
+            greater = join( mid, t, r );
+        }
+    }
+
+    /**
+     * Internal method to join l and r, where every item of l is less
+     *  than every item of r. Return the new root.
+     */
+    AvlNode * join( AvlNode *l, AvlNode *r )
+    {
+        if( r == NULL )
+            return l;
+        AvlNode *middle = detachMin( r );
+        return join( l, middle, r );
+    }
+
+    /**
+     * Internal method for lazy deletion: take by occurrences of x (all of
+     *  them if by < 0) off its count and the weights on the search path.
+     *  Nothing moves; the node becomes a tombstone when its count hits 0.
+     */
+    void removeLazily( const Comparable & x, int by )
+    {
+        AvlNode *path[ 128 ];     // Deeper than any balanced tree in memory
+        int depth = 0;
+        AvlNode *target = root;
+        while( target != NULL )
+        {
+            path[ depth++ ] = target;
+            if( x < target->element )
+                target = target->left;
+            else if( target->element < x )
+                target = target->right;
+            else
+                break;
+        }
+        if( target == NULL || target->count == 0 )
+            return;
+
+        int removed = by < 0 || by > target->count ? target->count : by;
+        for( int i = 0; i < depth; i++ )
+            path[i]->weight -= removed;
+        target->count -= removed;
+        if( target->count > 0 )
+            return;
+        tombstones++;
+        if( tombstones > lazyFraction * ( size( ) + tombstones ) )
+            compact( );
+    }
+
+    /**
+     * Internal method for removeIf( ): free the nodes of subtree t
+     *  matching pred and append the rest, in order, to kept.
+     */
+    template <typename Predicate>
+    void removeIf( AvlNode *t, Predicate & pred, vector<AvlNode *> & kept )
+    {
+        if( t == NULL )
+            return;
+
+        AvlNode *right = t->right;
+        removeIf( t->left, pred, kept );
+        if( t->count == 0 || pred( t->element ) )     // Tombstones go too
+            freeNode( t );
+        else
+            kept.push_back( t );
+        removeIf( right, pred, kept );
+    }
+
+    /**
+     * Internal method to link nodes[lo, hi), already in sorted order,
+     *  into a perfectly balanced subtree. Return its root.
+     */
+    AvlNode * buildBalanced( const vector<AvlNode *> & nodes, size_t lo, size_t hi )
+    {
+        if( lo >= hi )
+            return NULL;
+
+        size_t mid = lo + ( hi - lo ) / 2;
+        AvlNode *t = nodes[mid];
+        t->left = buildBalanced( nodes, lo, mid );
+        t->right = buildBalanced( nodes, mid + 1, hi );
+        t->height = Balance::builtRank( height( t->left ), height( t->right ) );
+        update( t );
+        return t;
+    }
+
+    /**
+     * Internal method to unlink the smallest node of non-empty subtree t
+     *  without freeing it. Return the detached node.
+     */
+    AvlNode * detachMin( AvlNode * & t )
+    {
+        if( t->left == NULL )
+        {
+            AvlNode *minNode = t;
+            t = t->right;
+            return minNode;
+        }
+        AvlNode *minNode = detachMin( t->left );
+        Balance::afterRemove( *this, t );
+        return minNode;
+    }
+
+    /**
+     * Internal method to visit subtree t in sorted order.
+     */
+    template <typename Func>
+    void forEach( AvlNode *t, Func & f ) const
+    {
+        if( t != NULL )
+        {
+            forEach( t->left, f );
+            for( int i = 0; i < t->count; i++ )
+                f( t->element );
+            forEach( t->right, f );
+        }
+    }
+
+    /**
+     * Internal method to visit items of subtree t within [lo, hi].
+     */
+    template <typename Func>
+    void forEachInRange( const Comparable & lo, const Comparable & hi,
+                         AvlNode *t, Func & f ) const
+    {
+        if( t == NULL )
+            return;
+        if( lo < t->element )
+            forEachInRange( lo, hi, t->left, f );
+        if( !( t->element < lo ) && !( hi < t->element ) )
+            for( int i = 0; i < t->count; i++ )
+                f( t->element );
+        if( t->element < hi )
+            forEachInRange( lo, hi, t->right, f );
     }
 
     /**
@@ -434,7 +1280,7 @@ class AvlTree
         else if( t->element < x )
             return contains( x, t->right );
         else
-            return true;    // Match
+            return t->count > 0;    // Match, unless a tombstone
     }
 
 /****** NONRECURSIVE VERSION*************************
@@ -456,13 +1302,13 @@ class AvlTree
      * Internal method to make subtree empty.
      *  TODO: Implement freeing all tree nodes
      */
-    void makeEmpty( AvlNode * & t )
+    static void makeEmpty( AvlNode * & t )
     {
 		if (t) {
 
 			makeEmpty(t->left);
 			makeEmpty(t->right);
-			delete t;
+			freeNode(t);
 		}
 		t = NULL;
       //cout << " [d] makeEmpty should walk the tree and free all nodes" << endl;
@@ -477,7 +1323,8 @@ class AvlTree
         if( t != NULL )
         {
             printInOrder( t->left );
-            cout << t->element << " ";
+            if( t->count > 0 )
+                cout << t->element << " ";
             printInOrder( t->right );
         }
     }
@@ -489,7 +1336,8 @@ class AvlTree
     {
         if( t != NULL )
         {
-            cout << t->element << " ";
+            if( t->count > 0 )
+                cout << t->element << " ";
             printPreOrder( t->left );
             printPreOrder( t->right );
         }
@@ -504,7 +1352,8 @@ class AvlTree
         {
             printPostOrder( t->left );
             printPostOrder( t->right );
-            cout << t->element << " ";
+            if( t->count > 0 )
+                cout << t->element << " ";
         }
     }
 
@@ -514,7 +1363,7 @@ class AvlTree
      */
     void printLevelOrder( AvlNode *t ) const
 	{ 
-		int h = height(t);
+		int h = treeHeight(t);
 		for (int i = 1; i <= h+1; i++) { 
 			printLevel(t, i); //printing nodes at all level
 		}
@@ -526,7 +1375,8 @@ class AvlTree
 			return;
 		}
 		if (level == 1) { //if there's root then print the value
-			cout << root->element << " ";
+			if (root->count > 0) // Skip tombstones
+				cout << root->element << " ";
 		}
 		else if (level > 1)
 		{
@@ -546,23 +1396,179 @@ class AvlTree
 			return NULL;
 		}
 		else {
-			return new AvlNode(t->element, clone(t->left),
-				clone(t->right), t->height);
+			AvlNode *copy = new AvlNode(t->element, clone(t->left),
+				clone(t->right), t->height, t->count);
+			copy->weight = t->weight;
+			return copy;
 		}
         // Check if t is null (can't copy NULL?
         // Otherwise, Make a new AvlNode and clone t's values recursively
     }
 
+    /**
+     * Release node t, whether it came from new or from a NodeArena.
+     */
+    static void freeNode( AvlNode *t )
+    {
+        if( t->pooled )
+            t->~AvlNode( );
+        else
+            delete t;
+    }
+
+    /**
+     * Internal method to deep copy subtree t for the copy operations.
+     *  Big trees are cloned in parallel into NodeArenas we then hold.
+     */
+    AvlNode * copyNodes( AvlNode *t )
+    {
+        if( size( t ) < PARALLEL_MIN_SIZE )
+            return clone( t );
+
+        mutex arenaLock;
+        return parallelClone( t, forkDepth( t ), arenaLock );
+    }
+
+    /**
+     * Number of tree levels to fork worker threads for: enough for
+     *  about two tasks per hardware thread, none for small trees.
+     */
+    static int forkDepth( AvlNode *t )
+    {
+        if( t == NULL || t->weight < PARALLEL_MIN_SIZE )
+            return 0;
+        unsigned threads = thread::hardware_concurrency( );
+        int depth = 1;
+        while( ( 1u << depth ) < 2 * threads )
+            depth++;
+        return depth;
+    }
+
+    /**
+     * Internal method to clone subtree t, forking the left subtree onto
+     *  another thread for the top depth levels. Below that each subtree
+     *  is copied in pre order into its own exactly sized NodeArena.
+     */
+    AvlNode * parallelClone( AvlNode *t, int depth, mutex & arenaLock )
+    {
+        if( t == NULL )
+            return NULL;
+
+        if( depth == 0 )
+        {
+            shared_ptr<NodeArena> arena( new NodeArena( countNodes( t ) ) );
+            AvlNode *next = arena->slots;
+            AvlNode *copy = cloneInto( t, next );
+            lock_guard<mutex> guard( arenaLock );
+            arenas.push_back( arena );
+            return copy;
+        }
+
+        future<AvlNode *> left = async( launch::async, [this, t, depth, &arenaLock]( ) {
+            return parallelClone( t->left, depth - 1, arenaLock );
+        } );
+        AvlNode *right = parallelClone( t->right, depth - 1, arenaLock );
+        AvlNode *copy = new AvlNode( t->element, left.get( ), right, t->height, t->count );
+        copy->weight = t->weight;
+        return copy;
+    }
+
+    /**
+     * Internal method to clone subtree t in pre order into consecutive
+     *  arena slots starting at next, which is advanced past them.
+     */
+    static AvlNode * cloneInto( AvlNode *t, AvlNode * & next )
+    {
+        if( t == NULL )
+            return NULL;
+
+        AvlNode *copy = new ( next++ ) AvlNode( t->element, NULL, NULL, t->height, t->count );
+        copy->weight = t->weight;
+        copy->pooled = true;
+        copy->left = cloneInto( t->left, next );
+        copy->right = cloneInto( t->right, next );
+        return copy;
+    }
+
+    /**
+     * Internal method to count the nodes (not occurrences) of subtree t.
+     */
+    static size_t countNodes( AvlNode *t )
+    {
+        return t == NULL ? 0 : countNodes( t->left ) + countNodes( t->right ) + 1;
+    }
+
+    /**
+     * Internal method for parallelForEach( ) over subtree t.
+     */
+    template <typename Func>
+    void parallelForEach( AvlNode *t, int depth, Func & f ) const
+    {
+        if( t == NULL )
+            return;
+        if( depth == 0 )
+        {
+            forEach( t, f );
+            return;
+        }
+
+        future<void> left = async( launch::async, [this, t, depth, &f]( ) {
+            parallelForEach( t->left, depth - 1, f );
+        } );
+        for( int i = 0; i < t->count; i++ )
+            f( t->element );
+        parallelForEach( t->right, depth - 1, f );
+        left.get( );
+    }
+
+    /**
+     * Internal method for parallelReduce( ) over subtree t.
+     */
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce( AvlNode *t, int depth, const T & identity,
+                      Map & map, Combine & combine ) const
+    {
+        if( t == NULL )
+            return identity;
+
+        future<T> left;
+        if( depth > 0 )
+            left = async( launch::async, [this, t, depth, &identity, &map, &combine]( ) {
+                return parallelReduce( t->left, depth - 1, identity, map, combine );
+            } );
+
+        T result = depth > 0 ? identity
+                             : parallelReduce( t->left, 0, identity, map, combine );
+        for( int i = 0; i < t->count; i++ )
+            result = combine( result, map( t->element ) );
+        T right = parallelReduce( t->right, depth > 0 ? depth - 1 : 0, identity, map, combine );
+        if( depth > 0 )
+            result = combine( left.get( ), result );
+        return combine( result, right );
+    }
+
 
     // Avl manipulations
     /**
      * Return the height of node t or -1 if NULL.
+     *  This is the rank the Balance policy keeps, which is only the
+     *  true height for HEIGHT_BALANCED policies.
      */
     int height( AvlNode *t ) const
     {
         return t == NULL ? -1 : t->height;
     }
 
+    /**
+     * Return the true height of subtree t (NULL == -1).
+     */
+    int treeHeight( AvlNode *t ) const
+    {
+        if( Balance::HEIGHT_BALANCED || t == NULL )
+            return height( t );
+        return max( treeHeight( t->left ), treeHeight( t->right ) ) + 1;
+    }
+
     int max( int lhs, int rhs ) const
     {
         return lhs > rhs ? lhs : rhs;
@@ -578,8 +1584,8 @@ class AvlTree
         AvlNode *k1 = k2->left;
         k2->left = k1->right;
         k1->right = k2;
-        k2->height = max( height( k2->left ), height( k2->right ) ) + 1;
-        k1->height = max( height( k1->left ), k2->height ) + 1;
+        update( k2 );
+        update( k1 );
         k2 = k1;
     }
 
@@ -593,8 +1599,8 @@ class AvlTree
         AvlNode *k2 = k1->right;
         k1->right = k2->left;
         k2->left = k1;
-        k1->height = max( height( k1->left ), height( k1->right ) ) + 1;
-        k2->height = max( height( k2->right ), k1->height ) + 1;
+        update( k1 );
+        update( k2 );
         k1 = k2;
     }
 
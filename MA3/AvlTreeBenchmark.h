@@ -0,0 +1,166 @@
+/*
+ *  AvlTreeBenchmark.h - Timing the balancing policies against each other
+ *   Build optimized with 'make bench' before trusting any numbers.
+ */
+
+#include "AvlTree.h"
+#include "AdaptiveAvlTree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+/*****************************************************************************/
+// Run ops random inserts/removes (removePercent of them removes) against a
+// tree pre-filled with prefill keys. Print ops/sec and the final height.
+template <typename Balance>
+void bench_policyMix( const char *policy, int removePercent, int prefill, int ops )
+{
+  AvlTree<int, Balance> tree;
+  mt19937 rng( 223 );
+  uniform_int_distribution<int> keys( 0, 4 * prefill );
+  uniform_int_distribution<int> coin( 0, 99 );
+  for( int i = 0; i < prefill; i++ )
+    tree.insert( keys( rng ) );
+
+  vector<int> plan( ops );
+  vector<bool> isRemove( ops );
+  for( int i = 0; i < ops; i++ ) {
+    plan[i] = keys( rng );
+    isRemove[i] = coin( rng ) < removePercent;
+  }
+
+  auto start = chrono::steady_clock::now();
+  for( int i = 0; i < ops; i++ ) {
+    if( isRemove[i] )
+      tree.remove( plan[i] );
+    else
+      tree.insert( plan[i] );
+  }
+  double secs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+  printf( "   %-16s %3d%% removes  %8.2f Mops/s  size %7d  height %2d\n",
+          policy, removePercent, ops / secs / 1e6, tree.size(), tree.height() );
+}
+
+
+/*****************************************************************************/
+// Move-assign a fresh tree of n keys over the live one rounds times and
+// print the worst and median assignment latency, freeing the old tree in
+// place or on the reclaimer thread.
+void bench_treeSwap( bool deferred, int n, int rounds )
+{
+  vector<int> keys( n );
+  for( int i = 0; i < n; i++ )
+    keys[i] = i;
+
+  AvlTree<int> live;
+  live.setDeferredDestruction( deferred );
+  live.assignSorted( keys.begin(), keys.end() );
+
+  vector<double> millis;
+  for( int r = 0; r < rounds; r++ ) {
+    AvlTree<int> next;
+    next.assignSorted( keys.begin(), keys.end() );
+    auto start = chrono::steady_clock::now();
+    live = std::move( next );
+    millis.push_back( chrono::duration<double, milli>( chrono::steady_clock::now() - start ).count() );
+    AvlReclaimer::instance().drain();     // Keep rounds independent
+  }
+  sort( millis.begin(), millis.end() );
+  printf( "   %-16s %8d nodes  median %8.3f ms  max %8.3f ms\n",
+          deferred ? "deferred" : "in place", n, millis[millis.size() / 2], millis.back() );
+}
+
+
+/*****************************************************************************/
+// Build 'sets' sets of setSize random keys each, then time 'lookups' random
+// contains( ) calls spread over them. Print the time for each phase.
+template <typename Set>
+void bench_smallSets( const char *kind, int sets, int setSize, int lookups )
+{
+  mt19937 rng( 223 );
+  uniform_int_distribution<int> keys( 0, 4 * setSize );
+  auto start = chrono::steady_clock::now();
+  vector<Set> all( sets );
+  for( Set & s : all )
+    for( int i = 0; i < setSize; i++ )
+      s.insert( keys( rng ) );
+  double buildSecs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+  uniform_int_distribution<int> pick( 0, sets - 1 );
+  long hits = 0;
+  start = chrono::steady_clock::now();
+  for( int i = 0; i < lookups; i++ )
+    hits += all[ pick( rng ) ].contains( keys( rng ) );
+  double lookupSecs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+  printf( "   %-16s %d sets of %d  build %7.1f ms  lookups %6.2f Mops/s  (%ld hits)\n",
+          kind, sets, setSize, buildSecs * 1e3, lookups / lookupSecs / 1e6, hits );
+}
+
+
+/*****************************************************************************/
+// Fill a tree with n keys, then time a burst removing half of them in
+// random order, with eager removal or lazy deletion at the given fraction.
+template <typename Key, typename MakeKey>
+void bench_deleteBurst( const char *kind, double lazyFraction, int n, MakeKey makeKey )
+{
+  vector<Key> keys;
+  for( int i = 0; i < n; i++ )
+    keys.push_back( makeKey( i ) );
+  sort( keys.begin(), keys.end() );
+
+  AvlTree<Key> tree;
+  tree.assignSorted( keys.begin(), keys.end() );
+  tree.setLazyDeletion( lazyFraction );
+  shuffle( keys.begin(), keys.end(), mt19937( 223 ) );
+
+  auto start = chrono::steady_clock::now();
+  for( int i = 0; i < n / 2; i++ )
+    tree.remove( keys[i] );
+  double secs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+  printf( "   %-8s lazy %.2f  %8d removes  %6.2f Mops/s  tombstones left %7d\n",
+          kind, lazyFraction, n / 2, n / 2 / secs / 1e6, tree.tombstoneCount() );
+}
+
+
+/*
+ *  Compare AVL, WAVL and red-black across insert/remove mixes
+ */
+int avlTreeBenchmarks( )
+{
+  const int prefill = 200000;
+  const int ops = 1000000;
+  cout << " [x] Balancing policy benchmark: " << prefill << " prefill, "
+       << ops << " ops per run" << endl;
+  int mixes[] = { 0, 25, 50, 75 };
+  for( int removePercent : mixes ) {
+    bench_policyMix<AvlBalance>( "AvlBalance", removePercent, prefill, ops );
+    bench_policyMix<WavlBalance>( "WavlBalance", removePercent, prefill, ops );
+    bench_policyMix<RedBlackBalance>( "RedBlackBalance", removePercent, prefill, ops );
+  }
+
+  cout << " [x] Whole-tree swap latency (move assignment)" << endl;
+  bench_treeSwap( false, 2000000, 9 );
+  bench_treeSwap( true, 2000000, 9 );
+
+  cout << " [x] Small sets: nodes versus the inline array" << endl;
+  bench_smallSets< AvlTree<int> >( "AvlTree", 100000, 16, 2000000 );
+  bench_smallSets< AdaptiveAvlTree<int> >( "AdaptiveAvlTree", 100000, 16, 2000000 );
+
+  cout << " [x] Delete burst: eager removal versus tombstones" << endl;
+  auto intKey = []( int i ) { return i; };
+  auto stringKey = []( int i ) { return string( 56, 'k' ) + to_string( 10000000 + i ); };
+  for( double fraction : { 0.0, 0.25, 0.5 } )
+    bench_deleteBurst<int>( "int", fraction, 1000000, intKey );
+  for( double fraction : { 0.0, 0.25, 0.5 } )
+    bench_deleteBurst<string>( "string64", fraction, 1000000, stringKey );
+  return(0);
+}
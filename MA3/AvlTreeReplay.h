@@ -0,0 +1,302 @@
+/*
+ *  AvlTreeReplay.h - Replaying captured workload traces against the tree
+ *   Build optimized with 'make replay TRACE=file' before trusting any numbers.
+ *
+ *  Text traces hold one operation per line; '#' starts a comment:
+ *     i <key>          insert
+ *     r <key>          remove
+ *     c <key>          contains
+ *     q <lo> <hi>      range scan, visits every key in [lo, hi]
+ *  Binary traces start with the 8 bytes "AVLTRACE", followed by packed
+ *  17-byte records: op byte ('i', 'r', 'c' or 'q'), then two native
+ *  endian int64 operands (the second is only used by 'q').
+ *
+ *  The trace is read in chunks; only running the operations is timed.
+ *  With more than one thread each op goes to the thread picked by a hash
+ *  of its key (of lo for a range scan) and runs against a ShardedAvlTree.
+ *  Every op on one key thus runs on one thread in trace order; only ops
+ *  on different keys may interleave differently than in the trace.
+ */
+
+#ifndef AVL_TREE_REPLAY_H
+#define AVL_TREE_REPLAY_H
+
+#include "AvlTree.h"
+#include "ShardedAvlTree.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>  // For getrusage()
+using namespace std;
+
+
+struct TraceOp
+{
+  char    op;
+  int64_t a;
+  int64_t b;
+};
+
+struct ReplayStats
+{
+  unsigned long ops = 0;
+  unsigned long perOp[4] = { 0, 0, 0, 0 };   // i, r, c, q
+  unsigned long containsHits = 0;
+  unsigned long rangeItems = 0;
+  unsigned long latency[64] = { };           // Bucket b: [2^(b-1), 2^b) ns
+  double        seconds = 0;
+  int           finalSize = 0;
+  long          peakRssKb = 0;
+
+  void add( const ReplayStats & other )
+  {
+    ops += other.ops;
+    for( int i = 0; i < 4; i++ )
+      perOp[i] += other.perOp[i];
+    containsHits += other.containsHits;
+    rangeItems += other.rangeItems;
+    for( int b = 0; b < 64; b++ )
+      latency[b] += other.latency[b];
+  }
+};
+
+
+/*****************************************************************************/
+// Reads a text or binary trace a chunk at a time.
+// Throws IOException if the file cannot be read or a record is malformed.
+class TraceReader
+{
+ public:
+  explicit TraceReader( const string & path ) : in( path, ios::binary ), line( 0 )
+  {
+    if( !in )
+      throw IOException();
+    char magic[8];
+    binary = in.read( magic, 8 ) && !memcmp( magic, "AVLTRACE", 8 );
+    if( !binary ) {
+      in.clear();
+      in.seekg( 0 );
+    }
+  }
+
+  // Replace ops with up to max further operations; false at end of trace
+  bool next( vector<TraceOp> & ops, size_t max )
+  {
+    ops.clear();
+    while( ops.size() < max ) {
+      TraceOp t;
+      if( !( binary ? readRecord( t ) : readLine( t ) ) )
+        break;
+      ops.push_back( t );
+    }
+    return !ops.empty();
+  }
+
+  bool isBinary( ) const
+  {
+    return binary;
+  }
+
+ private:
+  ifstream      in;
+  bool          binary;
+  unsigned long line;
+
+  static bool knownOp( char op )
+  {
+    return op == 'i' || op == 'r' || op == 'c' || op == 'q';
+  }
+
+  bool readRecord( TraceOp & t )
+  {
+    char rec[17];
+    if( !in.read( rec, sizeof( rec ) ) ) {
+      if( in.gcount() != 0 )
+        throw IOException();            // Torn final record
+      return false;
+    }
+    t.op = rec[0];
+    memcpy( &t.a, rec + 1, 8 );
+    memcpy( &t.b, rec + 9, 8 );
+    if( !knownOp( t.op ) )
+      throw IOException();
+    return true;
+  }
+
+  bool readLine( TraceOp & t )
+  {
+    string text;
+    while( getline( in, text ) ) {
+      line++;
+      size_t hash = text.find( '#' );
+      if( hash != string::npos )
+        text.erase( hash );
+      istringstream fields( text );
+      string op;
+      if( !( fields >> op ) )
+        continue;                       // Blank or comment-only line
+      t.op = op[0];
+      t.b = 0;
+      if( op.size() != 1 || !knownOp( t.op ) || !( fields >> t.a ) ||
+          ( t.op == 'q' && !( fields >> t.b ) ) ) {
+        cerr << "  [!] Bad trace line " << line << ": " << text << endl;
+        throw IOException();
+      }
+      return true;
+    }
+    return false;
+  }
+};
+
+
+/*****************************************************************************/
+// Run one operation, timing it into stats.
+template <typename Tree>
+void replay_op( Tree & tree, const TraceOp & t, ReplayStats & stats )
+{
+  auto start = chrono::steady_clock::now();
+  int kind = 0;
+  switch( t.op ) {
+    case 'i': tree.insert( t.a ); kind = 0; break;
+    case 'r': tree.remove( t.a ); kind = 1; break;
+    case 'c': stats.containsHits += tree.contains( t.a ); kind = 2; break;
+    case 'q': {
+      unsigned long seen = 0;
+      tree.forEachInRange( t.a, t.b, [ &seen ]( const int64_t & ) { seen++; } );
+      stats.rangeItems += seen;
+      kind = 3;
+      break;
+    }
+  }
+  uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+                  chrono::steady_clock::now() - start ).count();
+  int bucket = ns == 0 ? 0 : 64 - __builtin_clzll( ns );
+  stats.latency[ bucket > 63 ? 63 : bucket ]++;
+  stats.perOp[kind]++;
+  stats.ops++;
+}
+
+
+/*****************************************************************************/
+// Thread that replays ops on key; Fibonacci mixing spreads sequential keys
+int replay_thread( int64_t key, int threads )
+{
+  uint64_t h = uint64_t( key ) * 0x9E3779B97F4A7C15ull;
+  return int( ( h >> 32 ) % uint64_t( threads ) );
+}
+
+
+/*
+ *  Replay the trace at path with the given number of threads
+ */
+ReplayStats replayTrace( const string & path, int threads )
+{
+  const size_t CHUNK = 1 << 20;
+  TraceReader reader( path );
+  ReplayStats total;
+  vector<TraceOp> ops;
+
+  if( threads <= 1 ) {
+    AvlTree<int64_t> tree;
+    while( reader.next( ops, CHUNK ) ) {
+      auto start = chrono::steady_clock::now();
+      for( const TraceOp & t : ops )
+        replay_op( tree, t, total );
+      total.seconds += chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+    }
+    total.finalSize = tree.size();
+  }
+  else {
+    ShardedAvlTree<int64_t> tree;
+    vector<ReplayStats> perThread( threads );
+    vector< vector<TraceOp> > dealt( threads );
+    while( reader.next( ops, CHUNK ) ) {
+      for( vector<TraceOp> & mine : dealt )
+        mine.clear();
+      for( const TraceOp & t : ops )
+        dealt[ replay_thread( t.a, threads ) ].push_back( t );
+
+      auto start = chrono::steady_clock::now();
+      vector<thread> workers;
+      for( int w = 0; w < threads; w++ )
+        workers.emplace_back( [ &, w ]() {
+          for( const TraceOp & t : dealt[w] )
+            replay_op( tree, t, perThread[w] );
+        } );
+      for( thread & w : workers )
+        w.join();
+      total.seconds += chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+    }
+    for( const ReplayStats & s : perThread )
+      total.add( s );
+    total.finalSize = tree.size();
+  }
+
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+  total.peakRssKb = usage.ru_maxrss;
+  return total;
+}
+
+
+/*****************************************************************************/
+// Smallest bucket bound that covers fraction p of the ops
+uint64_t replay_percentile( const ReplayStats & stats, double p )
+{
+  unsigned long want = (unsigned long)( p * stats.ops ), seen = 0;
+  for( int b = 0; b < 64; b++ ) {
+    seen += stats.latency[b];
+    if( seen > want || seen == stats.ops )
+      return 1ull << b;
+  }
+  return 0;
+}
+
+
+/*
+ *  Replay a trace file and report throughput, latency and memory
+ */
+int avlTreeReplay( const string & path, int threads )
+{
+  ReplayStats stats;
+  try {
+    stats = replayTrace( path, threads );
+  }
+  catch( IOException & ) {
+    cerr << "  [!] Could not replay trace " << path << endl;
+    return(1);
+  }
+
+  printf( " [x] Replayed %lu ops from %s on %d thread%s\n", stats.ops, path.c_str(),
+          threads, threads == 1 ? "" : "s" );
+  printf( "   insert %lu  remove %lu  contains %lu (%lu hits)  range %lu (%lu items)\n",
+          stats.perOp[0], stats.perOp[1], stats.perOp[2], stats.containsHits,
+          stats.perOp[3], stats.rangeItems );
+  printf( "   %.3f s  %.3f Mops/s  final size %d  peak RSS %ld KB\n", stats.seconds,
+          stats.seconds > 0 ? stats.ops / stats.seconds / 1e6 : 0.0,
+          stats.finalSize, stats.peakRssKb );
+  if( stats.ops == 0 )
+    return(0);
+
+  printf( "   latency p50 < %lu ns  p90 < %lu ns  p99 < %lu ns  p99.9 < %lu ns\n",
+          (unsigned long) replay_percentile( stats, 0.50 ),
+          (unsigned long) replay_percentile( stats, 0.90 ),
+          (unsigned long) replay_percentile( stats, 0.99 ),
+          (unsigned long) replay_percentile( stats, 0.999 ) );
+  for( int b = 0; b < 64; b++ ) {
+    if( stats.latency[b] == 0 )
+      continue;
+    printf( "    [%12llu, %12llu) ns  %10lu  %6.2f%%\n", b == 0 ? 0ull : 1ull << ( b - 1 ),
+            1ull << b, stats.latency[b], 100.0 * stats.latency[b] / stats.ops );
+  }
+  return(0);
+}
+
+#endif
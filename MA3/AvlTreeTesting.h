@@ -5,9 +5,23 @@
 
 
 #include "AvlTree.h"
+#include "AvlIntervalTree.h"
+#include "ShardedAvlTree.h"
+#include "DurableAvlTree.h"
+#include "CachedAvlTree.h"
+#include "AvlStringKey.h"
+#include "SharedAvlTree.h"
+#include "AvlTreeReplay.h"
+#include "StaticAvlTree.h"
+#include "AdaptiveAvlTree.h"
 #include <iostream>
 #include <string.h>
 #include <time.h>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <sys/wait.h>
+#include <sys/stat.h>
 
 
 /*****************************************************************************/
@@ -279,6 +293,882 @@ void test_print_level_order()
 }
 
 
+/*
+ *  Multiset mode: duplicates bump a per-node count instead of adding nodes
+ */
+void test_multiset()
+{
+	AvlTree<int> myTree( true );
+	myTree.insert( vector<int>{ 10, 5, 20, 10, 10, 5 } );
+	cout << "  [t] Testing multiset mode:" << endl;
+	cout << "   [t] size() counts duplicates (6): " << myTree.size() << " - ";
+	(myTree.size() == 6) ? cout << "Pass" : cout << "Fail";    cout << endl;
+
+	cout << "   [t] Repeated keys share nodes (height 1): " << myTree.height() << " - ";
+	(myTree.height() == 1) ? cout << "Pass" : cout << "Fail";    cout << endl;
+
+	cout << "   [t] count(10) == 3, count(7) == 0";
+	(myTree.count(10) == 3 && myTree.count(7) == 0) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	cout << "   [t] findKth(2) == 10, findKth(5) == 20, rank(20) == 5";
+	(myTree.findKth(2) == 10 && myTree.findKth(5) == 20 && myTree.rank(20) == 5)
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	myTree.removeOne( 10 );
+	myTree.removeAll( 5 );
+	cout << "   [t] removeOne(10), removeAll(5) leaves 10 10 20";
+	(myTree.size() == 3 && myTree.count(10) == 2 && !myTree.contains(5))
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Interval tree: overlap queries pruned by each subtree's max endpoint
+ */
+void test_interval_tree()
+{
+	AvlIntervalTree<int> myTree;
+	int ranges[][2] = { {15,20}, {10,30}, {17,19}, {5,20}, {12,15}, {30,40} };
+	for( auto & r : ranges )
+		myTree.insert( r[0], r[1] );
+	cout << "  [t] Testing interval tree:" << endl;
+
+	cout << "   [t] anyOverlap(6,7) yes, anyOverlap(41,50) no";
+	(myTree.anyOverlap(6, 7) && !myTree.anyOverlap(41, 50)) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	cout << "   [t] allOverlaps(14,16) Target: [5,20] [10,30] [12,15] [15,20]" << endl;
+	cout << "   [x] allOverlaps(14,16) Output: ";
+	for( auto & i : myTree.allOverlaps( 14, 16 ) )
+		cout << i << " ";
+	cout << endl;
+
+	myTree.remove( 10, 30 );
+	myTree.remove( 5, 20 );
+	vector< pair<int,int> > windows = { {21, 29}, {31, 31}, {0, 4} };
+	vector< vector< Interval<int> > > batch = myTree.allOverlaps( windows );
+	cout << "   [t] After removes, batch windows hit 0, 1, 0 intervals";
+	(batch[0].size() == 0 && batch[1].size() == 1 && batch[2].size() == 0)
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  split() cuts a tree in two around a key, join() glues them back
+ */
+void test_split_join()
+{
+	AvlTree<int> myTree;
+	for( int i = 1; i <= 100; i++ )
+		myTree.insert( i );
+	AvlTree<int> upper;
+	cout << "  [t] Testing split and join:" << endl;
+
+	myTree.split( 40, upper );
+	cout << "   [t] split(40) gives 39 + 61 items, 1..39 and 40..100";
+	(myTree.size() == 39 && upper.size() == 61 && myTree.findMax() == 39 && upper.findMin() == 40)
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	myTree.join( upper );
+	cout << "   [t] join() restores 100 items, height " << myTree.height();
+	(myTree.size() == 100 && upper.empty() && myTree.height() <= 7 && myTree.findKth(39) == 40)
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Sharded tree: threads hammer disjoint key ranges, shards split as they grow
+ */
+void test_sharded_tree()
+{
+	ShardedAvlTree<int> myTree( 256 );
+	cout << "  [t] Testing sharded tree with 4 threads:" << endl;
+	vector<thread> workers;
+	for( int w = 0; w < 4; w++ )
+		workers.push_back( thread( [&myTree, w]( ) {
+			for( int i = 0; i < 2000; i++ )
+				myTree.insert( w * 10000 + i );
+			for( int i = 0; i < 2000; i += 2 )
+				myTree.remove( w * 10000 + i );
+		} ) );
+	for( auto & t : workers )
+		t.join( );
+
+	cout << "   [t] size() == 4000 across " << myTree.shardCount() << " shards";
+	(myTree.size() == 4000 && myTree.shardCount() > 1) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	vector<int> seen;
+	myTree.forEachInRange( 9990, 10011, [&seen]( int x ) { seen.push_back( x ); } );
+	cout << "   [t] Range 9990..10011 Target: 10001 10003 10005 10007 10009 10011" << endl;
+	cout << "   [x] Range 9990..10011 Output: ";
+	for( int x : seen )
+		cout << x << " ";
+	cout << endl;
+
+	// A hot repeated key can't be split; inserts must not re-shard each time
+	ShardedAvlTree<int> bag( 64, true );
+	auto start = chrono::steady_clock::now();
+	for( int i = 0; i < 200000; i++ )
+		bag.insert( 7 );
+	int before = bag.shardCount();
+	for( int i = 0; i < 200000; i++ )
+		bag.count( 7 );                   // Reads never re-shard
+	double secs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+	cout << "   [t] 200000 inserts and counts of one key in " << secs << " s";
+	( bag.count( 7 ) == 200000 && bag.shardCount() == before && secs < 5 )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	// A heavy key must not stop the distinct keys beside it from splitting
+	ShardedAvlTree<int> heavy( 64, true );
+	for( int i = 0; i < 1000; i++ )
+		heavy.insert( 7 );
+	for( int i = 0; i < 400; i++ )
+		heavy.insert( 100 + i );
+	int visited = 0, last = -1;
+	bool ordered = true;
+	heavy.forEachInRange( 0, 1000, [ & ]( int x ) { ordered = ordered && last <= x; last = x; visited++; } );
+	cout << "   [t] 1000 x 7 plus 400 keys: " << heavy.shardCount() << " shards of at most 64 keys";
+	( heavy.shardCount() >= 8 && heavy.count( 7 ) == 1000 && heavy.size() == 1400 &&
+	  visited == 1400 && ordered ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Copying a big tree clones it in parallel; parallel traversal agrees
+ */
+void test_parallel_clone()
+{
+	AvlTree<int> myTree;
+	for( int i = 0; i < 50000; i++ )
+		myTree.insert( ( i * 7919 ) % 50000 );
+	cout << "  [t] Testing parallel clone and reduce:" << endl;
+	AvlTree<int> treeCopy{ myTree };
+
+	bool same = treeCopy.size() == myTree.size() && treeCopy.height() == myTree.height();
+	for( int k = 0; same && k < myTree.size(); k += 997 )
+		same = treeCopy.findKth( k ) == myTree.findKth( k );
+	treeCopy.remove( 0 );      // Arena nodes are removed like any other
+	treeCopy.insert( 50000 );
+	cout << "   [t] Copy has same shape and contents";
+	(same && treeCopy.size() == 50000 && treeCopy.contains(50000)) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	long long sum = myTree.parallelReduce( 0LL, []( int x ) { return (long long) x; },
+		[]( long long a, long long b ) { return a + b; } );
+	atomic<int> visited( 0 );
+	myTree.parallelForEach( [&visited]( int ) { visited++; } );
+	cout << "   [t] parallelReduce sum " << sum << ", parallelForEach visits " << visited;
+	(sum == 49999LL * 50000 / 2 && visited == 50000) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Same workload on every balancing policy: contents must agree, and
+ *  WAVL must match AVL's height while there have been no removes
+ */
+void test_balance_policies()
+{
+	AvlTree<int> avl;
+	AvlTree<int, WavlBalance> wavl;
+	AvlTree<int, RedBlackBalance> redBlack;
+	for( int i = 0; i < 1000; i++ ) {
+		int x = ( i * 7919 ) % 1000;
+		avl.insert( x );
+		wavl.insert( x );
+		redBlack.insert( x );
+	}
+	cout << "  [t] Testing balancing policies:" << endl;
+	cout << "   [t] Insert-only heights AVL " << avl.height() << ", WAVL " << wavl.height()
+	     << ", red-black " << redBlack.height();
+	(avl.height() == wavl.height() && redBlack.height() <= 20) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	for( int i = 0; i < 1000; i += 3 ) {
+		avl.remove( i );
+		wavl.remove( i );
+		redBlack.remove( i );
+	}
+	bool same = avl.size() == wavl.size() && avl.size() == redBlack.size();
+	for( int k = 0; same && k < avl.size(); k++ )
+		same = avl.findKth( k ) == wavl.findKth( k ) && avl.findKth( k ) == redBlack.findKth( k );
+	cout << "   [t] After removes all policies hold the same " << avl.size() << " items";
+	same ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Bulk removal: a contiguous range by split/join, scattered keys by rebuild
+ */
+void test_bulk_remove()
+{
+	AvlTree<int> myTree;
+	for( int i = 1; i <= 1000; i++ )
+		myTree.insert( i );
+	cout << "  [t] Testing removeRange() and removeIf():" << endl;
+
+	int removed = myTree.removeRange( 101, 900 );
+	cout << "   [t] removeRange(101,900) removes 800, leaves 1..100 and 901..1000";
+	(removed == 800 && myTree.size() == 200 && myTree.contains(100) && !myTree.contains(101)
+	 && !myTree.contains(900) && myTree.contains(901)) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	removed = myTree.removeIf( []( int x ) { return x % 2 == 0; } );
+	cout << "   [t] removeIf(even) removes 100, height " << myTree.height();
+	(removed == 100 && myTree.size() == 100 && myTree.findKth(50) == 901 && myTree.height() == 6)
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	AvlTree<int, RedBlackBalance> redBlack{ vector<int>{ 5, 1, 9, 3, 7 } };
+	redBlack.removeIf( []( int x ) { return x > 6; } );
+	redBlack.insert( 4 );
+	cout << "   [t] Red-black tree after removeIf() Target: 1 3 4 5" << endl;
+	cout << "   [x] Red-black tree after removeIf() Output: ";
+	redBlack.printInOrder();
+	cout << endl;
+}
+
+
+/*
+ *  Durable tree: reopening the directory recovers snapshot + log tail
+ */
+void test_durable_tree()
+{
+	char dir[] = "/tmp/avltreeXXXXXX";
+	if( mkdtemp( dir ) == NULL ) {
+		cout << "  [t] Testing durable tree - Fail (no temp dir)" << endl;
+		return;
+	}
+	cout << "  [t] Testing durable tree in " << dir << ":" << endl;
+	{
+		DurableAvlTree<int> myTree( dir );
+		for( int i = 1; i <= 100; i++ )
+			myTree.insert( i );
+		myTree.checkpoint();                      // Snapshot 1..100
+		for( int i = 2; i <= 100; i += 2 )
+			myTree.remove( i );                   // Only in the log
+		myTree.insert( 1000 );
+		myTree.sync();
+	}
+	{
+		string torn = string( dir ) + "/avl.log";   // Crash mid-append
+		FILE *log = fopen( torn.c_str(), "ab" );
+		fputs( "\x07garbage", log );
+		fclose( log );
+	}
+	{
+		DurableAvlTree<int> recovered( dir );
+		cout << "   [t] Recovered 51 items: 1 3 .. 99 and 1000";
+		(recovered.size() == 51 && recovered.contains(99) && !recovered.contains(100)
+		 && recovered.contains(1000)) ? cout << " - Pass" : cout << " - Fail";
+		cout << endl;
+		recovered.insert( 2000 );
+	}
+	DurableAvlTree<int> again( dir );       // Torn tail was cut, new record kept
+	cout << "   [t] Records after a torn tail survive the next reopen";
+	(again.size() == 52 && again.contains(2000)) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	remove( ( string( dir ) + "/avl.log" ).c_str() );
+	remove( ( string( dir ) + "/avl.snapshot" ).c_str() );
+	rmdir( dir );
+
+	char dir2[] = "/tmp/avltreeXXXXXX";         // Automatic checkpoints
+	if( mkdtemp( dir2 ) == NULL )
+		return;
+	DurabilityOptions opts;
+	opts.groupCommitRecords = 16;
+	opts.checkpointRecords = 1000;
+	const int n = 20000;
+	{
+		DurableAvlTree<int> myTree( dir2, opts );
+		for( int i = 1; i <= n; i++ )
+			myTree.insert( i );               // Appends race the compactor
+		for( int i = 2; i <= n; i += 2 )
+			myTree.remove( i );
+		myTree.sync();
+	}
+	struct stat logStat;
+	stat( ( string( dir2 ) + "/avl.log" ).c_str(), &logStat );
+	DurableAvlTree<int> compacted( dir2, opts );
+	bool all = compacted.size() == n / 2;
+	for( int i = 1; all && i <= n; i++ )
+		all = compacted.contains( i ) == ( i % 2 == 1 );
+	cout << "   [t] Background checkpoints keep the log short (" << logStat.st_size << " bytes)";
+	( all && logStat.st_size < 3 * n / 2 * 21 / 2 )     // Under half the records
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	remove( ( string( dir2 ) + "/avl.log" ).c_str() );
+	remove( ( string( dir2 ) + "/avl.snapshot" ).c_str() );
+	rmdir( dir2 );
+}
+
+
+/*
+ *  Hot-key cache: skewed lookups hit, every kind of change invalidates
+ */
+void test_hot_key_cache()
+{
+	CachedAvlTree<int> myTree;
+	for( int i = 0; i < 1000; i++ )
+		myTree.insert( i );
+	cout << "  [t] Testing hot-key cache:" << endl;
+
+	bool found = true;
+	for( int round = 0; round < 1000; round++ )
+		found = myTree.contains( round % 10 ) && found;   // 10 hot keys
+	cout << "   [t] Hot lookups hit rate " << myTree.hotKeyHitRate();
+	(found && myTree.hotKeyHitRate() > 0.95) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	myTree.remove( 3 );                 // Point update through the cache
+	myTree.removeRange( 5, 6 );         // Bulk change the cache didn't see
+	bool stale = myTree.contains( 3 ) || myTree.contains( 5 ) || !myTree.contains( 4 );
+	myTree.insert( 3 );
+	stale = stale || !myTree.contains( 3 );
+	CachedAvlTree<int> moved( std::move( myTree ) );
+	stale = stale || myTree.contains( 4 ) || !moved.contains( 4 );
+	myTree.makeEmpty();
+	cout << "   [t] No stale answers after remove/removeRange/insert/move";
+	!stale ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	// const lookups from several threads share the cache
+	CachedAvlTree<int, AvlBalance, 64> shared;
+	for( int i = 0; i < 1000; i += 2 )
+		shared.insert( i );
+	shared.resetHotKeyStats();
+	atomic<int> wrong( 0 );
+	vector<thread> readers;
+	for( int t = 0; t < 4; t++ )
+		readers.emplace_back( [ &shared, &wrong ]() {
+			const CachedAvlTree<int, AvlBalance, 64> & view = shared;
+			for( int i = 0; i < 100000; i++ )
+				if( view.contains( i % 200 ) != ( i % 2 == 0 ) )
+					wrong++;
+		} );
+	for( thread & r : readers )
+		r.join();
+	cout << "   [t] Concurrent const lookups agree with the tree";
+	( wrong == 0 && shared.hotKeyHits() + shared.hotKeyMisses() == 400000 )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	// Hits on a few hot slots only read them, so readers don't turn them into misses
+	shared.resetHotKeyStats();
+	readers.clear();
+	for( int t = 0; t < 4; t++ )
+		readers.emplace_back( [ &shared ]() {
+			const CachedAvlTree<int, AvlBalance, 64> & view = shared;
+			for( int i = 0; i < 100000; i++ )
+				view.contains( 2 * ( i % 4 ) );
+		} );
+	for( thread & r : readers )
+		r.join();
+	cout << "   [t] Concurrent hot lookups hit rate " << shared.hotKeyHitRate();
+	( shared.hotKeyHitRate() > 0.99 ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	CachedAvlTree<string> names;              // Keys read under the slot lock
+	for( int i = 0; i < 100; i++ )
+		names.insert( "name-" + to_string( 2 * i ) );
+	wrong = 0;
+	readers.clear();
+	for( int t = 0; t < 4; t++ )
+		readers.emplace_back( [ &names, &wrong ]() {
+			const CachedAvlTree<string> & view = names;
+			for( int i = 0; i < 20000; i++ )
+				if( view.contains( "name-" + to_string( i % 200 ) ) != ( i % 2 == 0 ) )
+					wrong++;
+		} );
+	for( thread & r : readers )
+		r.join();
+	cout << "   [t] Concurrent string lookups agree with the tree";
+	( wrong == 0 ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  String keys: inline prefix compares must order exactly like std::string
+ */
+void test_string_keys()
+{
+	vector<string> words = { "pear", "apple", "applesauce", "applesauces", "app",
+	                         string( "app\0", 4 ), "banana", "zebra", "applesauce" };
+	AvlStringArena arena;
+	AvlStringTree<> myTree;
+	for( auto & w : words )
+		myTree.insert( AvlStringKey( w, arena ) );
+	cout << "  [t] Testing string keys:" << endl;
+
+	vector<string> sorted( words.begin(), words.end() - 1 );   // Last is a duplicate
+	sort( sorted.begin(), sorted.end() );
+	bool same = myTree.size() == (int) sorted.size();
+	for( int k = 0; same && k < myTree.size(); k++ )
+		same = myTree.findKth( k ).str() == sorted[k];
+	cout << "   [t] In-order matches std::string order for " << sorted.size() << " keys";
+	same ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	cout << "   [t] contains(applesauce), !contains(applesauc)";
+	(myTree.contains( AvlStringKey( "applesauce" ) ) && !myTree.contains( AvlStringKey( "applesauc" ) ))
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	string big( 40000, 'q' );
+	AvlStringKey bigKey( big + "!", arena );
+	cout << "   [t] Arena round-trips a 40KB key, hash matches a heap copy";
+	(bigKey.str() == big + "!" && hash<AvlStringKey>()( bigKey ) == AvlStringKey( big + "!" ).hashValue())
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	// Probes borrow the caller's bytes; stored copies must own theirs
+	bool probes = true;
+	for( auto & w : words )
+		probes = probes && myTree.contains( AvlStringKey::probe( w ) );
+	string scratch = "apple pie with cream";
+	probes = probes && !myTree.contains( AvlStringKey::probe( scratch ) ) &&
+	         hash<AvlStringKey>()( AvlStringKey::probe( scratch ) ) == AvlStringKey( scratch ).hashValue();
+	myTree.insert( AvlStringKey::probe( scratch ) );
+	scratch.assign( scratch.size(), 'x' );     // The stored key must not see this
+	probes = probes && myTree.contains( AvlStringKey( "apple pie with cream" ) );
+	myTree.remove( AvlStringKey::probe( string( "apple pie with cream" ) ) );
+	CachedAvlTree<AvlStringKey> cached;
+	cached.insert( AvlStringKey( "a long enough key" ) );
+	probes = probes && cached.contains( AvlStringKey::probe( "a long enough key", 17 ) ) &&
+	         myTree.size() == (int) sorted.size();
+	cout << "   [t] Borrowed probes find, hash, insert and remove like owning keys";
+	probes ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+// Shared-tree key whose compare kills the process when it sees a negative
+struct DyingKey
+{
+	int v;
+
+	bool operator<( const DyingKey & rhs ) const
+	{
+		if( v < 0 || rhs.v < 0 )
+			_exit( 0 );                       // Simulated crash mid-update
+		return v < rhs.v;
+	}
+};
+
+
+/*
+ *  Shared-memory tree: a writer and readers in other mappings and processes
+ */
+void test_shared_tree()
+{
+	string name = "/avltree-test-" + to_string( getpid() );
+	SharedAvlTree<int>::unlink( name );
+	cout << "  [t] Testing shared-memory tree:" << endl;
+	{
+		SharedAvlTree<int> writer( name, 1 << 20 );
+		for( int i = 0; i < 1000; i++ )
+			writer.insert( ( i * 37 ) % 1000 );
+		for( int i = 0; i < 1000; i += 2 )
+			writer.remove( i );
+
+		SharedAvlTree<int> reader( name );      // Second mapping, new address
+		vector<int> items = reader.snapshot();
+		bool ok = reader.size() == 500 && items.size() == 500 && reader.findMin() == 1 &&
+		          reader.findMax() == 999 && is_sorted( items.begin(), items.end() );
+		cout << "   [t] Reader mapping sees the writer's 500 odd keys";
+		ok ? cout << " - Pass" : cout << " - Fail";
+		cout << endl;
+
+		bool secondWriter = false;
+		try { SharedAvlTree<int> other( name, 1 << 20 ); }
+		catch( IOException & ) { secondWriter = true; }
+		bool readOnly = false;
+		try { reader.insert( 2 ); }
+		catch( IllegalArgumentException & ) { readOnly = true; }
+		cout << "   [t] Second writer and reader inserts are refused";
+		( secondWriter && readOnly ) ? cout << " - Pass" : cout << " - Fail";
+		cout << endl;
+
+		// A child process reads while this one keeps writing
+		pid_t child = fork();
+		if( child == 0 )
+		{
+			SharedAvlTree<int> childReader( name );
+			bool good = true;
+			for( int round = 0; round < 2000 && good; round++ )
+				good = childReader.contains( 999 ) && !childReader.contains( 0 );
+			_exit( good ? 0 : 1 );
+		}
+		for( int i = 0; i < 20000; i++ )
+		{
+			writer.insert( 2000 + i % 500 );
+			writer.remove( 2000 + ( i * 7 ) % 500 );
+		}
+		int status = 1;
+		waitpid( child, &status, 0 );
+		cout << "   [t] Child process reads consistently during writes";
+		( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ) ? cout << " - Pass" : cout << " - Fail";
+		cout << endl;
+
+		bool full = false;
+		SharedAvlTree<int>::unlink( name + "-small" );
+		SharedAvlTree<int> small( name + "-small", 4096 );
+		try { for( int i = 0; i < 4096; i++ ) small.insert( i ); }
+		catch( OverflowException & ) { full = true; }
+		cout << "   [t] Full region throws OverflowException, tree intact";
+		( full && small.size() > 0 && small.contains( 0 ) && small.contains( small.size() - 1 ) )
+			? cout << " - Pass" : cout << " - Fail";
+		cout << endl;
+		SharedAvlTree<int>::unlink( name + "-small" );
+	}
+	SharedAvlTree<int>::unlink( name );
+
+	// A writer that dies mid-update must not hang readers or be papered over
+	string torn = name + "-torn";
+	SharedAvlTree<DyingKey>::unlink( torn );
+	{
+		SharedAvlTree<DyingKey> writer( torn, 1 << 16 );
+		writer.insert( DyingKey { 1 } );
+	}
+	SharedAvlTree<DyingKey> reader( torn );
+	pid_t child = fork();
+	if( child == 0 )
+	{
+		SharedAvlTree<DyingKey> writer( torn, 1 << 16 );
+		writer.insert( DyingKey { -1 } );     // Exits inside the update
+		_exit( 1 );
+	}
+	int status = 1;
+	waitpid( child, &status, 0 );
+	bool readerThrew = false, writerThrew = false;
+	try { reader.contains( DyingKey { 1 } ); }
+	catch( IOException & ) { readerThrew = true; }
+	try { SharedAvlTree<DyingKey> writer( torn, 1 << 16 ); }
+	catch( IOException & ) { writerThrew = true; }
+	cout << "   [t] Writer dead mid-update: readers and new writers throw";
+	( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 && readerThrew && writerThrew )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+	SharedAvlTree<DyingKey>::unlink( torn );
+}
+
+
+/*
+ *  Deferred destruction: big trees are detached in O(1) and freed later
+ */
+void test_deferred_destruction()
+{
+	const int n = 100000;
+	vector<int> vals( n );
+	for( int i = 0; i < n; i++ )
+		vals[i] = i;
+
+	AvlTree<int> holder;
+	holder.setDeferredDestruction( true );
+	holder.assignSorted( vals.begin(), vals.end() );
+	cout << "  [t] Testing deferred destruction:" << endl;
+
+	unsigned long before = AvlReclaimer::instance().completed();
+	auto start = chrono::steady_clock::now();
+	holder.makeEmpty();
+	double detachMs = chrono::duration<double, milli>( chrono::steady_clock::now() - start ).count();
+	cout << "   [t] makeEmpty on " << n << " nodes returned in " << detachMs << " ms, tree empty";
+	( holder.isEmpty() && holder.size() == 0 ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	// Arena nodes from a parallel clone must travel with the detached graph
+	AvlTree<int> source;
+	source.assignSorted( vals.begin(), vals.end() );
+	holder = source;                        // Parallel clone into arenas
+	holder = AvlTree<int>( vector<int>{ 1, 2, 3 } );   // Move-assign over it
+	AvlReclaimer::instance().drain();
+	cout << "   [t] Reclaimer freed both graphs, replacement intact";
+	( AvlReclaimer::instance().completed() >= before + 2 && holder.size() == 3 &&
+	  holder.contains( 2 ) && source.size() == n && holder.deferredDestruction() )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	// A burst faster than the idle-priority thread frees must stay bounded
+	AvlTree<int> small;
+	small.setDeferredDestruction( true );
+	size_t worst = 0;
+	for( int round = 0; round < 4 * (int) AvlReclaimer::MAX_JOBS; round++ )
+	{
+		small.assignSorted( vals.begin(), vals.begin() + 4096 );
+		small.makeEmpty();
+		worst = max( worst, AvlReclaimer::instance().pending() );
+	}
+	AvlReclaimer::instance().drain();
+	cout << "   [t] Burst of " << 4 * AvlReclaimer::MAX_JOBS << " hand-overs, queue peaked at " << worst;
+	( worst <= AvlReclaimer::MAX_JOBS && small.isEmpty() ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Trace replay: text and binary traces, one and several threads
+ */
+void test_trace_replay()
+{
+	char textPath[] = "/tmp/avltree-traceXXXXXX";
+	int fd = mkstemp( textPath );
+	string text = "# warm up\n";
+	for( int i = 0; i < 100; i++ )
+		text += "i " + to_string( i ) + "\n";
+	text += "r 10\n\nr 11   # two removes\nc 10\nc 12\nq 0 49\n";
+	write( fd, text.data(), text.size() );
+	close( fd );
+
+	char binPath[] = "/tmp/avltree-traceXXXXXX";
+	fd = mkstemp( binPath );
+	string bin = "AVLTRACE";
+	auto record = [ &bin ]( char op, int64_t a, int64_t b ) {
+		bin.push_back( op );
+		bin.append( (const char *) &a, 8 );
+		bin.append( (const char *) &b, 8 );
+	};
+	for( int i = 0; i < 1000; i++ )
+		record( 'i', i, 0 );
+	for( int i = 0; i < 1000; i += 4 )
+		record( 'r', i, 0 );
+	record( 'c', 4, 0 );
+	record( 'c', 5, 0 );
+	write( fd, bin.data(), bin.size() );
+	close( fd );
+
+	cout << "  [t] Testing trace replay:" << endl;
+	ReplayStats t = replayTrace( textPath, 1 );
+	cout << "   [t] Text trace: 105 ops, 1 contains hit, 48 in range, 98 left";
+	( t.ops == 105 && t.containsHits == 1 && t.rangeItems == 48 && t.finalSize == 98 )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	ReplayStats b = replayTrace( binPath, 1 );
+	ReplayStats b4 = replayTrace( binPath, 4 );
+	unsigned long timed = 0;
+	for( unsigned long n : b4.latency )
+		timed += n;
+	cout << "   [t] Binary trace, 1 and 4 threads: 1252 ops, 750 left";
+	( b.ops == 1252 && b.finalSize == 750 && b.containsHits == 1 &&
+	  b4.ops == 1252 && timed == 1252 && b4.perOp[1] == 250 &&
+	  b4.finalSize == 750 && b4.containsHits == 1 )     // Per-key order kept
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	fd = open( textPath, O_WRONLY | O_APPEND );
+	write( fd, "x 1\n", 4 );
+	close( fd );
+	bool rejected = false;
+	try { replayTrace( textPath, 1 ); }
+	catch( IOException & ) { rejected = true; }
+	cout << "   [t] Malformed line throws IOException";
+	rejected ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	unlink( textPath );
+	unlink( binPath );
+}
+
+
+/*
+ *  Static tree: built and searched entirely at compile time
+ */
+void test_static_tree()
+{
+	static constexpr auto primes = makeStaticAvlTree<int>( { 29, 2, 17, 3, 23, 5, 19, 7, 11, 13 } );
+	static_assert( primes.contains( 13 ) && !primes.contains( 12 ), "folded at compile time" );
+	static_assert( primes.findMin() == 2 && primes.findMax() == 29 && primes.height() == 3 );
+	cout << "  [t] Testing static tree:" << endl;
+
+	bool ok = true;
+	AvlTree<int> reference( vector<int>{ 29, 2, 17, 3, 23, 5, 19, 7, 11, 13 } );
+	for( int x = -1; x <= 31; x++ )
+		ok = ok && primes.contains( x ) == reference.contains( x ) &&
+		     primes.rank( x ) == reference.rank( x );
+	cout << "   [t] contains and rank agree with AvlTree for -1..31";
+	ok ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	constexpr auto one = makeStaticAvlTree<int>( { 42 } );
+	constexpr StaticAvlTree<int, 0> none( array<int, 0>{ } );
+	bool underflow = false;
+	try { none.findMin(); }
+	catch( UnderflowException & ) { underflow = true; }
+	cout << "   [t] One-item and empty tables";
+	( one.contains( 42 ) && one.height() == 0 && none.isEmpty() && !none.contains( 1 ) && underflow )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Adaptive tree: inline sorted array that promotes and demotes
+ */
+void test_adaptive_tree()
+{
+	AdaptiveAvlTree<int, AvlBalance, 8> myTree;
+	AvlTree<int> reference;
+	cout << "  [t] Testing adaptive tree:" << endl;
+
+	bool ok = true, wasInline = true, promoted = false, demoted = false;
+	for( int i = 0; i < 2000 && ok; i++ )
+	{
+		int x = ( i * 7919 ) % 23;
+		if( i % 3 == 2 || ( i / 200 ) % 2 == 1 )
+		{
+			myTree.remove( x );
+			reference.remove( x );
+		}
+		else
+		{
+			myTree.insert( x );
+			reference.insert( x );
+		}
+		promoted = promoted || ( wasInline && !myTree.isInline() );
+		demoted = demoted || ( !wasInline && myTree.isInline() );
+		wasInline = myTree.isInline();
+		ok = myTree.size() == reference.size() && myTree.rank( 11 ) == reference.rank( 11 ) &&
+		     myTree.contains( x ) == reference.contains( x ) &&
+		     ( myTree.isEmpty() || myTree.findMax() == reference.findMax() );
+	}
+	cout << "   [t] 2000 mixed ops match AvlTree, promoted and demoted";
+	( ok && promoted && demoted ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	AdaptiveAvlTree<int, AvlBalance, 8> bag( true );
+	for( int x : { 5, 1, 5, 3, 5 } )
+		bag.insert( x );
+	AdaptiveAvlTree<int, AvlBalance, 8> high;
+	bag.split( 4, high );
+	bool multi = bag.isInline() && high.isInline() && bag.size() == 2 && high.count( 5 ) == 3;
+	bag.join( high );
+	multi = multi && bag.size() == 5 && high.isEmpty() && bag.findKth( 4 ) == 5 &&
+	        bag.removeRange( 2, 4 ) == 1 && bag.count( 5 ) == 3;
+	bag.removeOne( 5 );
+	multi = multi && bag.count( 5 ) == 2 && bag.removeIf( []( int x ) { return x == 1; } ) == 1;
+	cout << "   [t] Multiset split/join/removeRange/removeIf while inline";
+	( multi && bag.size() == 2 ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	AdaptiveAvlTree<string> words;           // Moves must not empty the strings
+	for( string w : { "pear", "apple", "fig", "plum" } )
+		words.insert( w );
+	int none = words.removeIf( []( const string & ) { return false; } );
+	int figs = words.removeIf( []( const string & w ) { return w == "fig"; } );
+	cout << "   [t] String removeIf keeps the survivors intact";
+	( none == 0 && figs == 1 && words.size() == 3 && words.findKth( 0 ) == "apple" &&
+	  words.findKth( 1 ) == "pear" && words.findKth( 2 ) == "plum" )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
+/*
+ *  Lazy deletion: tombstones, revival and amortized rebuilds
+ */
+template <typename Balance>
+bool lazy_matches_eager( const char *policy )
+{
+	AvlTree<int, Balance> lazy, eager;
+	lazy.setLazyDeletion( 0.25 );
+	mt19937 rng( 7 );
+	uniform_int_distribution<int> keys( 0, 3000 );
+	bool ok = true, sawTombstones = false;
+	for( int i = 0; i < 20000 && ok; i++ )
+	{
+		int x = keys( rng );
+		if( i % 2 == 0 || i > 15000 )
+		{
+			lazy.remove( x );
+			eager.remove( x );
+		}
+		else
+		{
+			lazy.insert( x );
+			eager.insert( x );
+		}
+		sawTombstones = sawTombstones || lazy.tombstoneCount() > 0;
+		ok = lazy.size() == eager.size() && lazy.contains( x ) == eager.contains( x ) &&
+		     lazy.tombstoneCount() <= 0.25 * ( lazy.size() + lazy.tombstoneCount() ) + 1 &&
+		     ( eager.isEmpty() ? lazy.isEmpty() :
+		       lazy.findMin() == eager.findMin() && lazy.findMax() == eager.findMax() &&
+		       lazy.rank( x ) == eager.rank( x ) );
+	}
+	vector<int> a, b;
+	lazy.forEach( [ &a ]( int x ) { a.push_back( x ); } );
+	eager.forEach( [ &b ]( int x ) { b.push_back( x ); } );
+	cout << "   [t] " << policy << ": 20000 ops match eager removal, tombstones bounded";
+	ok = ok && sawTombstones && a == b;
+	ok ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+	return ok;
+}
+
+void test_lazy_deletion()
+{
+	cout << "  [t] Testing lazy deletion:" << endl;
+	lazy_matches_eager<AvlBalance>( "AvlBalance" );
+	lazy_matches_eager<WavlBalance>( "WavlBalance" );
+	lazy_matches_eager<RedBlackBalance>( "RedBlackBalance" );
+
+	AvlTree<int> myTree;
+	myTree.setLazyDeletion( 0.5 );
+	for( int i = 0; i < 100; i++ )
+		myTree.insert( i );
+	int height = myTree.height();
+	for( int i = 0; i < 40; i++ )
+		myTree.remove( i );
+	bool ok = myTree.tombstoneCount() == 40 && myTree.height() == height &&
+	          myTree.size() == 60 && myTree.findMin() == 40 && myTree.findKth( 0 ) == 40 &&
+	          !myTree.contains( 7 );
+	myTree.insert( 7 );                     // Revives the tombstone
+	ok = ok && myTree.tombstoneCount() == 39 && myTree.contains( 7 ) && myTree.findMin() == 7;
+	AvlTree<int> high;
+	myTree.split( 50, high );               // Compacts first
+	ok = ok && myTree.tombstoneCount() == 0 && myTree.size() == 11 && high.size() == 50;
+	cout << "   [t] No rotations on remove, revive on insert, compact on split";
+	ok ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	AvlTree<int> bag( true );
+	bag.setLazyDeletion( 0.5 );
+	for( int x : { 4, 4, 4, 9 } )
+		bag.insert( x );
+	bag.removeOne( 4 );
+	bag.removeAll( 9 );
+	bool multi = bag.count( 4 ) == 2 && bag.size() == 2 && bag.tombstoneCount() == 1 &&
+	             bag.findMax() == 4;
+	bag.setLazyDeletion( 0 );               // Turning it off compacts
+	cout << "   [t] Multiset removeOne/removeAll, then switch off";
+	( multi && bag.tombstoneCount() == 0 && bag.size() == 2 ) ? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+
+	AvlIntervalTree<int> intervals;           // maxEnd would cover tombstones
+	intervals.insert( 1, 100 );
+	bool refused = false;
+	try { intervals.setLazyDeletion( 0.5 ); }
+	catch( IllegalArgumentException & ) { refused = true; }
+	intervals.remove( 1, 100 );
+	cout << "   [t] Augmented trees refuse lazy deletion";
+	( refused && intervals.lazyDeletion() == 0 && !intervals.anyOverlap( 50, 60 ) )
+		? cout << " - Pass" : cout << " - Fail";
+	cout << endl;
+}
+
+
 /*
  *  Testing features of your AVL Tree implementation
  */
@@ -301,6 +1191,24 @@ int avlTreeTests( bool fuzzing )
   test_move_assignment_op(); // Move= operator tests
 	test_print_level_order();  // Print tree in LEVEL order
 
+	cout << " [x] Starting extension tests. ----------------" << endl;
+	test_multiset();           // Duplicate counting, weighted order statistics
+	test_interval_tree();      // Overlap queries on AvlIntervalTree
+	test_split_join();         // split() and join() of whole trees
+	test_sharded_tree();       // Multi-threaded ShardedAvlTree
+	test_parallel_clone();     // Parallel copy into arenas, parallel reduce
+	test_balance_policies();   // AVL, WAVL and red-black agree
+	test_bulk_remove();        // removeRange() and removeIf()
+	test_durable_tree();       // Write-ahead log and crash recovery
+	test_hot_key_cache();      // CachedAvlTree hit rate and invalidation
+	test_string_keys();        // AvlStringKey prefix compares
+	test_shared_tree();        // SharedAvlTree across mappings and processes
+	test_deferred_destruction(); // makeEmpty/assignment via AvlReclaimer
+	test_trace_replay();       // --replay driver on small traces
+	test_static_tree();        // constexpr StaticAvlTree
+	test_adaptive_tree();      // AdaptiveAvlTree inline/tree switching
+	test_lazy_deletion();      // Tombstones and amortized rebuilds
+
 	return(0);
 }
 
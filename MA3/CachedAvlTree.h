@@ -0,0 +1,392 @@
+#ifndef CACHED_AVL_TREE_H
+#define CACHED_AVL_TREE_H
+
+#include "AvlTree.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>     // For memcpy()
+#include <functional>  // For hash
+#include <memory>
+#include <type_traits>
+using namespace std;
+
+// CachedAvlTree class
+//
+// CONSTRUCTION: like AvlTree
+//
+// An AvlTree with a small direct-mapped cache of contains( ) answers in
+// front of it, for skewed (Zipfian) lookups where a few keys get most of
+// the traffic. A hit costs one hash and one compare; a miss falls through
+// to the O(log n) tree walk and fills the slot. Both present and absent
+// answers are cached.
+//
+// insert/remove through this class update the key's slot; any other change
+// (bulk operations, makeEmpty, moves, calls through an AvlTree reference)
+// is noticed through AvlTree::version( ) and flushes the whole cache in
+// O(1) by advancing its epoch.
+//
+// contains( ) is const and may run on several threads at once, as with
+// AvlTree. Each slot carries a sequence number, odd while the slot is
+// being filled. For trivially copyable keys a hit only reads: it loads
+// the sequence, the key and the answer, then checks that the sequence
+// did not move. Misses fill the slot only if they win it; a lookup never
+// waits for another. Other key types cannot be read while they change,
+// so their lookups hold the slot for the compare. Hit and miss counters
+// are striped over cache lines by thread. Mutations still need the
+// caller's exclusive access, as with AvlTree.
+//
+// ******************PUBLIC OPERATIONS*********************
+// bool contains( x )     --> Cached lookup
+// unsigned long hotKeyHits( ) / hotKeyMisses( ) --> Counters
+// double hotKeyHitRate( ) --> hits / ( hits + misses )
+// void resetHotKeyStats( ) --> Zero the counters
+// ... plus everything AvlTree provides
+// ******************ERRORS********************************
+// As AvlTree
+
+template <typename Comparable, typename Balance = AvlBalance, int SLOTS = 4096>
+class CachedAvlTree : public AvlTree<Comparable, Balance>
+{
+    static_assert( SLOTS > 0 && ( SLOTS & ( SLOTS - 1 ) ) == 0, "SLOTS must be a power of two" );
+
+  public:
+    typedef AvlTree<Comparable, Balance> Base;
+
+    CachedAvlTree( ) : Base( ), cache( new Cache( ) )
+    {
+    }
+
+    explicit CachedAvlTree( bool isMultiset ) : Base( isMultiset ), cache( new Cache( ) )
+    {
+    }
+
+    CachedAvlTree( vector<Comparable> vals ) : Base( vals ), cache( new Cache( ) )
+    {
+    }
+
+    /**
+     * Copies start with a cold cache of their own.
+     */
+    CachedAvlTree( const CachedAvlTree & other ) : Base( other ), cache( new Cache( ) )
+    {
+    }
+
+    /**
+     * The cache moves with the tree; the source is left with a cold one.
+     */
+    CachedAvlTree( CachedAvlTree && other )
+      : Base( std::move( other ) ), cache( std::move( other.cache ) )
+    {
+        other.cache.reset( new Cache( ) );
+        flush( );
+    }
+
+    const CachedAvlTree & operator= ( const CachedAvlTree & other )
+    {
+        Base::operator=( other );
+        flush( );
+        return *this;
+    }
+
+    const CachedAvlTree & operator= ( CachedAvlTree && other )
+    {
+        if( this != &other )
+        {
+            Base::operator=( std::move( other ) );
+            cache.swap( other.cache );
+            flush( );
+            other.flush( );
+        }
+        return *this;
+    }
+
+    /**
+     * Returns true if x is found; answered from the cache when x is hot.
+     */
+    bool contains( const Comparable & x ) const
+    {
+        if( cache->version.load( memory_order_acquire ) != this->version( ) )
+            flush( );
+
+        Entry & e = cache->slots[ slotFor( x ) ];
+        uint32_t epoch = cache->epoch.load( memory_order_relaxed );
+        bool present;
+        if( e.lookup( x, epoch, present ) )
+        {
+            counter( ).hits.fetch_add( 1, memory_order_relaxed );
+            return present;
+        }
+
+        counter( ).misses.fetch_add( 1, memory_order_relaxed );
+        present = Base::contains( x );
+        uint32_t seq;
+        if( e.tryLock( seq ) )          // Slot busy: leave it, don't wait
+        {
+            e.store( x, epoch, present );
+            e.unlock( seq );
+        }
+        return present;
+    }
+
+    /**
+     * Insert x and mark it present in the cache.
+     */
+    void insert( const Comparable & x )
+    {
+        bool inSync = cache->version.load( memory_order_relaxed ) == this->version( );
+        Base::insert( x );
+        if( inSync )
+        {
+            fill( cache->slots[ slotFor( x ) ], x, true );
+            cache->version.store( this->version( ), memory_order_release );
+        }
+    }
+
+    using Base::insert;
+
+    /**
+     * Remove x and mark it absent in the cache.
+     */
+    void remove( const Comparable & x )
+    {
+        bool inSync = cache->version.load( memory_order_relaxed ) == this->version( );
+        Base::remove( x );
+        if( inSync )
+        {
+            fill( cache->slots[ slotFor( x ) ], x, false );
+            cache->version.store( this->version( ), memory_order_release );
+        }
+    }
+
+    unsigned long hotKeyHits( ) const
+    {
+        unsigned long total = 0;
+        for( const Counter & c : cache->counters )
+            total += c.hits.load( memory_order_relaxed );
+        return total;
+    }
+
+    unsigned long hotKeyMisses( ) const
+    {
+        unsigned long total = 0;
+        for( const Counter & c : cache->counters )
+            total += c.misses.load( memory_order_relaxed );
+        return total;
+    }
+
+    double hotKeyHitRate( ) const
+    {
+        unsigned long hits = hotKeyHits( ), total = hits + hotKeyMisses( );
+        return total == 0 ? 0.0 : double( hits ) / total;
+    }
+
+    void resetHotKeyStats( )
+    {
+        for( Counter & c : cache->counters )
+        {
+            c.hits.store( 0, memory_order_relaxed );
+            c.misses.store( 0, memory_order_relaxed );
+        }
+    }
+
+  private:
+    static const int STRIPES = 16;       // Counter lines; threads share them round robin
+
+    /**
+     * Key storage a reader may copy while a writer changes it: the bytes
+     *  of a trivially copyable key, held in relaxed atomic words.
+     */
+    template <typename Key, bool Optimistic = is_trivially_copyable<Key>::value>
+    struct KeyCell
+    {
+        static const int WORDS = ( sizeof( Key ) + 7 ) / 8;
+        atomic<uint64_t> words[ WORDS ];
+
+        KeyCell( )
+        {
+            for( atomic<uint64_t> & w : words )
+                w.store( 0, memory_order_relaxed );
+        }
+
+        void store( const Key & x )
+        {
+            uint64_t raw[ WORDS ] = { };
+            memcpy( raw, &x, sizeof( Key ) );
+            for( int i = 0; i < WORDS; i++ )
+                words[i].store( raw[i], memory_order_relaxed );
+        }
+
+        void load( Key & x ) const
+        {
+            uint64_t raw[ WORDS ];
+            for( int i = 0; i < WORDS; i++ )
+                raw[i] = words[i].load( memory_order_relaxed );
+            memcpy( static_cast<void *>( &x ), raw, sizeof( Key ) );
+        }
+    };
+
+    /**
+     * Any other key is a plain value, only touched with the slot held.
+     */
+    template <typename Key>
+    struct KeyCell<Key, false>
+    {
+        Key key;
+
+        KeyCell( ) : key( ) { }
+
+        void store( const Key & x )
+        {
+            key = x;
+        }
+    };
+
+    /**
+     * A slot is live only while its epoch matches the cache's. seq is odd
+     *  while one thread holds the slot to change (or, for keys that are
+     *  not trivially copyable, read) it.
+     */
+    struct Entry
+    {
+        atomic<uint32_t> seq;
+        atomic<uint32_t> epoch;
+        atomic<bool>     present;
+        KeyCell<Comparable> cell;
+
+        Entry( ) : seq( 0 ), epoch( 0 ), present( false ) { }
+
+        /**
+         * Hit test for x at epoch; a torn or busy read is a miss.
+         */
+        bool lookup( const Comparable & x, uint32_t now, bool & answer )
+        {
+            if constexpr( is_trivially_copyable<Comparable>::value )
+            {
+                uint32_t before = seq.load( memory_order_acquire );
+                if( before & 1 )
+                    return false;
+                Comparable key;
+                cell.load( key );
+                bool live = epoch.load( memory_order_relaxed ) == now;
+                answer = present.load( memory_order_relaxed );
+                atomic_thread_fence( memory_order_acquire );
+                if( seq.load( memory_order_relaxed ) != before )
+                    return false;
+                return live && !( key < x ) && !( x < key );
+            }
+            else
+            {
+                uint32_t held;
+                if( !tryLock( held ) )
+                    return false;
+                bool hit = epoch.load( memory_order_relaxed ) == now &&
+                           !( cell.key < x ) && !( x < cell.key );
+                answer = present.load( memory_order_relaxed );
+                unlock( held );
+                return hit;
+            }
+        }
+
+        void store( const Comparable & x, uint32_t now, bool answer )
+        {
+            cell.store( x );
+            epoch.store( now, memory_order_relaxed );
+            present.store( answer, memory_order_relaxed );
+        }
+
+        /**
+         * Take the slot by moving seq from even to odd; held is the odd value.
+         */
+        bool tryLock( uint32_t & held )
+        {
+            uint32_t s = seq.load( memory_order_relaxed );
+            if( ( s & 1 ) || !seq.compare_exchange_strong( s, s + 1, memory_order_acquire ) )
+                return false;
+            held = s + 1;
+            atomic_thread_fence( memory_order_release );   // seq odd before the stores
+            return true;
+        }
+
+        void lock( uint32_t & held )
+        {
+            while( !tryLock( held ) )
+                ;
+        }
+
+        void unlock( uint32_t held )
+        {
+            seq.store( held + 1, memory_order_release );
+        }
+    };
+
+    struct alignas( 64 ) Counter
+    {
+        atomic<unsigned long> hits { 0 };
+        atomic<unsigned long> misses { 0 };
+    };
+
+    /**
+     * epoch and version are read by every lookup and written only by
+     *  flushes, so they get a line of their own, away from the counters.
+     */
+    struct alignas( 64 ) Cache
+    {
+        Entry slots[ SLOTS ];
+        alignas( 64 ) atomic<uint32_t> epoch { 1 };
+        atomic<unsigned long> version { 0 };   // Tree version the slots describe
+        Counter counters[ STRIPES ];
+    };
+
+    unique_ptr<Cache> cache;
+
+    /**
+     * Fibonacci-mix the key's hash so that identity hashes of small
+     *  integers still spread over the slots.
+     */
+    static size_t slotFor( const Comparable & x )
+    {
+        uint64_t h = hash<Comparable>( )( x ) * 0x9E3779B97F4A7C15ull;
+        return size_t( h >> 40 ) & ( SLOTS - 1 );
+    }
+
+    void fill( Entry & e, const Comparable & x, bool present ) const
+    {
+        uint32_t held;
+        e.lock( held );
+        e.store( x, cache->epoch.load( memory_order_relaxed ), present );
+        e.unlock( held );
+    }
+
+    /**
+     * This thread's counter line.
+     */
+    Counter & counter( ) const
+    {
+        static atomic<unsigned> threads( 0 );
+        thread_local unsigned stripe = threads.fetch_add( 1, memory_order_relaxed ) % STRIPES;
+        return cache->counters[ stripe ];
+    }
+
+    /**
+     * Forget every slot in O(1) and resynchronize with the tree.
+     *  Lookups racing to flush each advance the epoch; that is harmless.
+     */
+    void flush( ) const
+    {
+        uint32_t next = cache->epoch.fetch_add( 1, memory_order_relaxed ) + 1;
+        if( next == 0 )                  // Wrapped: stale epochs could match
+        {
+            for( Entry & e : cache->slots )
+            {
+                uint32_t held;
+                e.lock( held );
+                e.epoch.store( 0, memory_order_relaxed );
+                e.unlock( held );
+            }
+            cache->epoch.store( 1, memory_order_relaxed );
+        }
+        cache->version.store( this->version( ), memory_order_release );
+    }
+};
+
+#endif
@@ -0,0 +1,617 @@
+#ifndef DURABLE_AVL_TREE_H
+#define DURABLE_AVL_TREE_H
+
+#include "AvlTree.h"
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>      // For rename()
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>     // For open()
+#include <sys/stat.h>  // For fstat()
+#include <unistd.h>    // For write(), pread(), fsync(), ftruncate(), dup2()
+using namespace std;
+
+// DurableAvlTree class
+//
+// CONSTRUCTION: with a directory for the log and snapshot files
+//
+// An AvlTree whose mutations survive a crash. Every insert/remove is
+// applied to the in-memory tree, then appended to a memory buffer; a
+// background flusher thread writes the buffer to DIR/avl.log and fsyncs
+// it once per batch (group commit), so callers never wait on the disk.
+// checkpoint( ) writes an O(n) sorted snapshot to DIR/avl.snapshot and
+// truncates the log. Once checkpointRecords records are on disk, a
+// compactor thread does the same in the background while the flusher
+// keeps committing: it rebuilds the tree from the snapshot and the
+// durable prefix of the log, writes the snapshot, then swaps in a log
+// holding only the records appended meanwhile. The flusher only waits
+// for that last copy. The rebuild briefly holds a second copy of the
+// tree, so peak memory is about twice the tree's.
+// Opening the directory again loads the snapshot in O(n) and replays
+// only the log records written after it.
+//
+// Mutations must come from one thread at a time, as with AvlTree.
+//
+// ******************PUBLIC OPERATIONS*********************
+// void insert( x )       --> Insert x and log it
+// void remove( x )       --> Remove x and log it
+// void makeEmpty( )      --> Remove all items and log it
+// void checkpoint( )     --> Snapshot the tree, truncate the log
+// void sync( )           --> Block until every logged mutation is on disk
+// bool contains( x ), int size( ), ... --> Through tree( )
+// ******************ERRORS********************************
+// Throws IOException if the files cannot be opened, written or read
+
+/**
+ *  Binary encoding of keys in the log and snapshot. The default copies
+ *  trivially copyable types byte for byte; specialize for others.
+ */
+template <typename Comparable>
+struct AvlSerializer
+{
+    static_assert( is_trivially_copyable<Comparable>::value,
+                   "Specialize AvlSerializer for this key type" );
+
+    static void write( string & out, const Comparable & x )
+    {
+        out.append( reinterpret_cast<const char *>( &x ), sizeof( x ) );
+    }
+
+    static bool read( const char * & in, const char *end, Comparable & x )
+    {
+        if( size_t( end - in ) < sizeof( x ) )
+            return false;
+        memcpy( &x, in, sizeof( x ) );
+        in += sizeof( x );
+        return true;
+    }
+};
+
+template <>
+struct AvlSerializer<string>
+{
+    static void write( string & out, const string & x )
+    {
+        uint32_t len = x.size( );
+        out.append( reinterpret_cast<const char *>( &len ), sizeof( len ) );
+        out.append( x );
+    }
+
+    static bool read( const char * & in, const char *end, string & x )
+    {
+        uint32_t len;
+        if( size_t( end - in ) < sizeof( len ) )
+            return false;
+        memcpy( &len, in, sizeof( len ) );
+        if( size_t( end - in ) - sizeof( len ) < len )
+            return false;
+        x.assign( in + sizeof( len ), len );
+        in += sizeof( len ) + len;
+        return true;
+    }
+};
+
+/**
+ *  Knobs for the durable tree; zero disables a periodic trigger.
+ */
+struct DurabilityOptions
+{
+    size_t groupCommitRecords = 256;      // fsync once this many are buffered
+    int    groupCommitMillis = 5;         // ... or this long after the first
+    size_t checkpointRecords = 1 << 20;   // checkpoint after this many records
+};
+
+template <typename Comparable, typename Balance = AvlBalance>
+class DurableAvlTree
+{
+  public:
+    /**
+     * Open (or create) the tree stored in directory and recover it.
+     */
+    explicit DurableAvlTree( const string & directory,
+                             DurabilityOptions opts = DurabilityOptions( ),
+                             bool isMultiset = false )
+      : avl( isMultiset ), options( opts ), dirPath( directory ),
+        logPath( directory + "/avl.log" ), snapshotPath( directory + "/avl.snapshot" ),
+        logFd( -1 ), lastLsn( 0 ), durableLsn( 0 ), checkpointLsn( 0 ), stopping( false )
+    {
+        lastLsn = load( avl, true );
+        checkpointLsn = lastLsn;
+        logFd = open( logPath.c_str( ), O_WRONLY | O_CREAT | O_APPEND, 0644 );
+        struct stat st;
+        if( logFd < 0 || fstat( logFd, &st ) != 0 )
+            throw IOException( );
+        durableLsn = lastLsn;
+        fileBytes = syncedBytes = st.st_size;
+        flusher = thread( [this]( ) { flushLoop( ); } );
+        compactor = thread( [this]( ) { compactLoop( ); } );
+    }
+
+    /**
+     * Flush whatever is still buffered, then stop both threads.
+     */
+    ~DurableAvlTree( )
+    {
+        {
+            lock_guard<mutex> guard( logLock );
+            stopping = true;
+        }
+        logReady.notify_all( );
+        compactReady.notify_all( );
+        flusher.join( );
+        compactor.join( );
+        close( logFd );
+    }
+
+    DurableAvlTree( const DurableAvlTree & ) = delete;
+    DurableAvlTree & operator= ( const DurableAvlTree & ) = delete;
+
+    /**
+     * Read-only access to the in-memory tree.
+     */
+    const AvlTree<Comparable, Balance> & tree( ) const
+    {
+        return avl;
+    }
+
+    bool contains( const Comparable & x ) const
+    {
+        return avl.contains( x );
+    }
+
+    int size( ) const
+    {
+        return avl.size( );
+    }
+
+    /**
+     * Insert x and queue the log record.
+     */
+    void insert( const Comparable & x )
+    {
+        avl.insert( x );
+        append( INSERT, &x );
+    }
+
+    /**
+     * Remove x and queue the log record.
+     */
+    void remove( const Comparable & x )
+    {
+        avl.remove( x );
+        append( REMOVE, &x );
+    }
+
+    /**
+     * Empty the tree and queue the log record.
+     */
+    void makeEmpty( )
+    {
+        avl.makeEmpty( );
+        append( CLEAR, NULL );
+    }
+
+    /**
+     * Block until every mutation so far has been fsynced.
+     */
+    void sync( )
+    {
+        unique_lock<mutex> guard( logLock );
+        uint64_t target = lastLsn;
+        forceFlush = true;
+        logReady.notify_all( );
+        logDurable.wait( guard, [this, target]( ) { return durableLsn >= target || ioFailed; } );
+        forceFlush = false;
+        if( ioFailed )
+            throw IOException( );
+    }
+
+    /**
+     * Write a snapshot of the whole tree now, then truncate the log.
+     *  The snapshot is written to a temporary file, fsynced and renamed
+     *  into place, so a crash at any point leaves a usable pair of files.
+     */
+    void checkpoint( )
+    {
+        lock_guard<mutex> files( snapshotLock );
+        uint64_t snapshotLsn;
+        {
+            lock_guard<mutex> guard( logLock );
+            snapshotLsn = lastLsn;
+        }
+        if( !writeSnapshot( avl, snapshotLsn ) )
+            throw IOException( );
+
+        // Everything up to snapshotLsn is in the snapshot; drop it from
+        //  the buffer and the file. ioLock waits out an in-flight write.
+        lock_guard<mutex> guard( logLock );
+        lock_guard<mutex> io( ioLock );
+        pending.clear( );
+        pendingRecords = 0;
+        if( ftruncate( logFd, 0 ) != 0 )
+            throw IOException( );
+        fileBytes = syncedBytes = 0;
+        durableLsn = snapshotLsn;
+        checkpointLsn = snapshotLsn;
+        logDurable.notify_all( );
+    }
+
+  private:
+    enum Op : uint8_t { INSERT = 1, REMOVE = 2, CLEAR = 3 };
+
+    // Record layout: u32 body length, u32 checksum of body, body.
+    // Body: u64 lsn, u8 op, key (INSERT and REMOVE only).
+    static constexpr char SNAPSHOT_MAGIC[8] = { 'A', 'V', 'L', 'S', 'N', 'A', 'P', '1' };
+
+    AvlTree<Comparable, Balance> avl;
+    DurabilityOptions options;
+    string dirPath;
+    string logPath;
+    string snapshotPath;
+    int logFd;
+
+    mutex snapshotLock;             // Held while the snapshot is replaced
+    mutex ioLock;                   // Held while the log file is written
+    size_t fileBytes;               // Guarded by ioLock: bytes in the log
+    size_t syncedBytes;             //  ... of which fsynced
+
+    mutex logLock;                  // Guards everything below
+    condition_variable logReady;    // Flusher: records waiting
+    condition_variable logDurable;  // sync( ): durableLsn moved
+    condition_variable compactReady; // Compactor: checkpoint due
+    string pending;                 // Encoded records not yet written
+    size_t pendingRecords = 0;
+    uint64_t lastLsn;
+    uint64_t durableLsn;
+    uint64_t checkpointLsn;         // lastLsn at the last checkpoint or open
+    bool stopping;
+    bool forceFlush = false;
+    bool ioFailed = false;
+    bool compactDue = false;
+    thread flusher;
+    thread compactor;
+
+    /**
+     * FNV-1a, enough to spot a torn or garbage tail record.
+     */
+    static uint32_t checksum( const char *p, size_t n )
+    {
+        uint32_t h = 2166136261u;
+        for( size_t i = 0; i < n; i++ )
+            h = ( h ^ uint8_t( p[i] ) ) * 16777619u;
+        return h;
+    }
+
+    static bool writeAll( int fd, const string & bytes )
+    {
+        size_t done = 0;
+        while( done < bytes.size( ) )
+        {
+            ssize_t n = ::write( fd, bytes.data( ) + done, bytes.size( ) - done );
+            if( n <= 0 )
+                return false;
+            done += n;
+        }
+        return true;
+    }
+
+    static bool readFile( const string & path, string & bytes )
+    {
+        int fd = open( path.c_str( ), O_RDONLY );
+        if( fd < 0 )
+            return false;
+        char buf[1 << 16];
+        ssize_t n;
+        while( ( n = read( fd, buf, sizeof( buf ) ) ) > 0 )
+            bytes.append( buf, n );
+        close( fd );
+        if( n < 0 )
+            throw IOException( );
+        return true;
+    }
+
+    /**
+     * Encode one record into the pending buffer and wake the flusher
+     *  when a group is ready. This is all the caller pays for logging.
+     */
+    void append( Op op, const Comparable *x )
+    {
+        string body;
+        {
+            lock_guard<mutex> guard( logLock );
+            if( ioFailed )
+                throw IOException( );
+            uint64_t lsn = ++lastLsn;
+            body.append( reinterpret_cast<const char *>( &lsn ), sizeof( lsn ) );
+            body.push_back( char( op ) );
+            if( x != NULL )
+                AvlSerializer<Comparable>::write( body, *x );
+            uint32_t header[2] = { uint32_t( body.size( ) ), checksum( body.data( ), body.size( ) ) };
+            pending.append( reinterpret_cast<const char *>( header ), sizeof( header ) );
+            pending.append( body );
+            if( ++pendingRecords >= options.groupCommitRecords )
+                logReady.notify_one( );
+            else if( pendingRecords == 1 )
+                logReady.notify_one( );     // Start the group's timer
+        }
+    }
+
+    /**
+     * Background flusher: wait for a full group (or its time limit),
+     *  write it with one write( ) and make it durable with one fsync( ).
+     */
+    void flushLoop( )
+    {
+        unique_lock<mutex> guard( logLock );
+        for( ;; )
+        {
+            logReady.wait( guard, [this]( ) { return stopping || pendingRecords > 0; } );
+            if( !stopping && !forceFlush && pendingRecords < options.groupCommitRecords )
+                logReady.wait_for( guard, chrono::milliseconds( options.groupCommitMillis ),
+                    [this]( ) { return stopping || forceFlush ||
+                                       pendingRecords >= options.groupCommitRecords; } );
+            if( pendingRecords == 0 )
+            {
+                if( stopping )
+                    return;
+                continue;
+            }
+
+            string batch;
+            batch.swap( pending );
+            pendingRecords = 0;
+            uint64_t batchLsn = lastLsn;
+
+            unique_lock<mutex> io( ioLock );    // Taken before checkpoint( ) can
+            guard.unlock( );
+            bool ok = writeAll( logFd, batch ) && fdatasync( logFd ) == 0;
+            if( ok )
+            {
+                fileBytes += batch.size( );
+                syncedBytes = fileBytes;
+            }
+            io.unlock( );
+            guard.lock( );
+
+            if( !ok )
+                ioFailed = true;
+            else if( batchLsn > durableLsn )
+                durableLsn = batchLsn;
+            logDurable.notify_all( );
+
+            if( !ioFailed && !compactDue && options.checkpointRecords != 0 &&
+                durableLsn - checkpointLsn >= options.checkpointRecords )
+            {
+                compactDue = true;
+                compactReady.notify_one( );
+            }
+        }
+    }
+
+    /**
+     * Compactor thread: run the automatic checkpoints the flusher asks for.
+     */
+    void compactLoop( )
+    {
+        unique_lock<mutex> guard( logLock );
+        for( ;; )
+        {
+            compactReady.wait( guard, [this]( ) { return stopping || compactDue; } );
+            if( stopping )
+                return;
+            guard.unlock( );
+            bool compacted = compact( );
+            guard.lock( );
+            compactDue = false;
+            if( !compacted )
+            {
+                ioFailed = true;
+                logDurable.notify_all( );
+            }
+        }
+    }
+
+    /**
+     * Automatic checkpoint. The snapshot is rebuilt from the snapshot and
+     *  the fsynced prefix of the log rather than from the live tree,
+     *  which the caller may be changing. The flusher appends meanwhile;
+     *  replaceLog( ) keeps only what it wrote since.
+     */
+    bool compact( )
+    {
+        lock_guard<mutex> files( snapshotLock );
+        size_t prefix;
+        uint64_t snapshotLsn;
+        {
+            lock_guard<mutex> io( ioLock );
+            prefix = syncedBytes;
+        }
+
+        {
+            AvlTree<Comparable, Balance> shadow( avl.isMultiset( ) );
+            try
+            {
+                snapshotLsn = load( shadow, false, prefix );
+            }
+            catch( IOException & )
+            {
+                return false;
+            }
+            if( !writeSnapshot( shadow, snapshotLsn ) )
+                return false;
+        }
+
+        if( !replaceLog( prefix ) )
+            return false;
+        lock_guard<mutex> guard( logLock );
+        checkpointLsn = snapshotLsn;
+        return true;
+    }
+
+    /**
+     * Drop the first prefix bytes of the log: copy the rest to a new
+     *  file and rename it into place. ioLock keeps the flusher out, so
+     *  it only waits for the records it appended during the rebuild.
+     *  Never takes logLock, which the flusher holds while it waits here.
+     */
+    bool replaceLog( size_t prefix )
+    {
+        lock_guard<mutex> io( ioLock );
+        string tail;
+        int in = open( logPath.c_str( ), O_RDONLY );
+        if( in < 0 )
+            return false;
+        bool ok = readRange( in, prefix, fileBytes - prefix, tail );
+        close( in );
+
+        string tmpPath = logPath + ".tmp";
+        int out = open( tmpPath.c_str( ), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644 );
+        if( !ok || out < 0 )
+            return false;
+        ok = writeAll( out, tail ) && fsync( out ) == 0 &&
+             rename( tmpPath.c_str( ), logPath.c_str( ) ) == 0 && syncDirectory( ) &&
+             dup2( out, logFd ) >= 0;     // The flusher keeps its descriptor
+        close( out );
+        if( !ok )
+            return false;
+        fileBytes -= prefix;
+        syncedBytes -= prefix;
+        return true;
+    }
+
+    static bool readRange( int fd, size_t offset, size_t length, string & bytes )
+    {
+        bytes.resize( length );
+        size_t done = 0;
+        while( done < length )
+        {
+            ssize_t n = pread( fd, &bytes[ done ], length - done, offset + done );
+            if( n <= 0 )
+                return false;
+            done += n;
+        }
+        return true;
+    }
+
+    bool syncDirectory( )
+    {
+        int dir = open( dirPath.c_str( ), O_RDONLY | O_DIRECTORY );
+        if( dir < 0 )
+            return false;
+        bool ok = fsync( dir ) == 0;
+        close( dir );
+        return ok;
+    }
+
+    /**
+     * Write tree as the snapshot at lsn: to a temporary file, fsynced,
+     *  renamed into place, and the rename made durable by an fsync of
+     *  the directory before the caller may truncate the log.
+     */
+    bool writeSnapshot( const AvlTree<Comparable, Balance> & tree, uint64_t lsn )
+    {
+        string image;
+        uint64_t items = tree.size( );
+        image.append( SNAPSHOT_MAGIC, sizeof( SNAPSHOT_MAGIC ) );
+        image.append( reinterpret_cast<const char *>( &lsn ), sizeof( lsn ) );
+        image.append( reinterpret_cast<const char *>( &items ), sizeof( items ) );
+        tree.forEach( [&image]( const Comparable & x ) {
+            AvlSerializer<Comparable>::write( image, x );
+        } );
+
+        string tmpPath = snapshotPath + ".tmp";
+        int fd = open( tmpPath.c_str( ), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if( fd < 0 )
+            return false;
+        bool ok = writeAll( fd, image ) && fsync( fd ) == 0;
+        close( fd );
+        if( !ok || rename( tmpPath.c_str( ), snapshotPath.c_str( ) ) != 0 )
+            return false;
+        return syncDirectory( );
+    }
+
+    /**
+     * Load the snapshot into tree, then replay log records newer than it
+     *  from the first logBytes bytes of the log; return the last lsn
+     *  applied. With repair, a torn record at the end of the log (crash
+     *  mid-write) and everything after it is cut off.
+     */
+    uint64_t load( AvlTree<Comparable, Balance> & tree, bool repair,
+                   size_t logBytes = size_t( -1 ) )
+    {
+        uint64_t snapshotLsn = 0;
+        string bytes;
+        if( readFile( snapshotPath, bytes ) )
+        {
+            const char *p = bytes.data( ), *end = p + bytes.size( );
+            uint64_t items;
+            if( bytes.size( ) < sizeof( SNAPSHOT_MAGIC ) + 2 * sizeof( uint64_t ) ||
+                memcmp( p, SNAPSHOT_MAGIC, sizeof( SNAPSHOT_MAGIC ) ) != 0 )
+                throw IOException( );
+            p += sizeof( SNAPSHOT_MAGIC );
+            memcpy( &snapshotLsn, p, sizeof( snapshotLsn ) );
+            memcpy( &items, p + sizeof( snapshotLsn ), sizeof( items ) );
+            p += 2 * sizeof( uint64_t );
+
+            vector<Comparable> sorted;
+            sorted.reserve( items );
+            for( uint64_t i = 0; i < items; i++ )
+            {
+                sorted.push_back( Comparable( ) );
+                if( !AvlSerializer<Comparable>::read( p, end, sorted.back( ) ) )
+                    throw IOException( );
+            }
+            tree.assignSorted( sorted.begin( ), sorted.end( ) );
+        }
+        uint64_t last = snapshotLsn;
+
+        bytes.clear( );
+        if( !readFile( logPath, bytes ) )
+            return last;
+        if( bytes.size( ) > logBytes )
+            bytes.resize( logBytes );
+        const char *start = bytes.data( ), *p = start, *end = start + bytes.size( );
+        for( ;; )
+        {
+            uint32_t header[2];
+            if( size_t( end - p ) < sizeof( header ) )
+                break;
+            memcpy( header, p, sizeof( header ) );
+            const char *body = p + sizeof( header );
+            if( size_t( end - body ) < header[0] || checksum( body, header[0] ) != header[1] ||
+                header[0] < sizeof( uint64_t ) + 1 )
+                break;
+
+            uint64_t lsn;
+            memcpy( &lsn, body, sizeof( lsn ) );
+            Op op = Op( body[ sizeof( lsn ) ] );
+            const char *key = body + sizeof( lsn ) + 1;
+            if( lsn > snapshotLsn )
+            {
+                Comparable x = Comparable( );
+                if( op != CLEAR && !AvlSerializer<Comparable>::read( key, body + header[0], x ) )
+                    break;
+                if( op == INSERT )
+                    tree.insert( x );
+                else if( op == REMOVE )
+                    tree.remove( x );
+                else
+                    tree.makeEmpty( );
+                last = lsn;
+            }
+            p = body + header[0];
+        }
+
+        if( repair && p != end && truncate( logPath.c_str( ), p - start ) != 0 )
+            throw IOException( );
+        return last;
+    }
+};
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef SHARDED_AVL_TREE_H
+#define SHARDED_AVL_TREE_H
+
+#include "AvlTree.h"
+#include <algorithm>   // For upper_bound()
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+using namespace std;
+
+// ShardedAvlTree class
+//
+// CONSTRUCTION: with the largest shard size, or with initial shard bounds
+//
+// The key space is cut into consecutive ranges, one AvlTree per range,
+// each behind its own mutex. Point operations on different shards run in
+// parallel; only re-sharding takes the directory lock exclusively.
+// Oversized shards are split at their median, hot shards (far more
+// operations than average) are split too, and runs of small neighbours
+// are joined back together.
+//
+// ******************PUBLIC OPERATIONS*********************
+// void insert( x )       --> Insert x
+// void remove( x )       --> Remove x
+// bool contains( x )     --> Return true if x is present
+// int count( x )         --> Occurrences of x
+// int size( )            --> Total items over all shards
+// int shardCount( )      --> Number of shards right now
+// void forEachInRange( lo, hi, f ) --> f( x ) for lo <= x <= hi, in order
+// void rebalance( )      --> Split hot/oversized shards, join small ones
+// ******************ERRORS********************************
+// None; AvlTree's exceptions propagate
+
+template <typename Comparable>
+class ShardedAvlTree
+{
+  public:
+    /**
+     *  Start with one shard; shards split once they pass maxShardSize.
+     */
+    explicit ShardedAvlTree( int maxShardSize = 1 << 16, bool isMultiset = false )
+      : maxShard( maxShardSize < 2 ? 2 : maxShardSize ), multiset( isMultiset ),
+        opsSinceRebalance( 0 )
+    {
+        shards.push_back( unique_ptr<Shard>( new Shard( multiset, maxShard ) ) );
+    }
+
+    /**
+     *  Start with a shard per range; bounds must be strictly increasing.
+     *  Shard i holds [ bounds[i-1], bounds[i] ).
+     */
+    ShardedAvlTree( const vector<Comparable> & bounds, int maxShardSize = 1 << 16,
+                    bool isMultiset = false )
+      : maxShard( maxShardSize < 2 ? 2 : maxShardSize ), multiset( isMultiset ),
+        opsSinceRebalance( 0 )
+    {
+        shards.push_back( unique_ptr<Shard>( new Shard( multiset, maxShard ) ) );
+        for( auto & b : bounds )
+        {
+            if( !lowBounds.empty( ) && !( lowBounds.back( ) < b ) )
+                throw IllegalArgumentException( );
+            lowBounds.push_back( b );
+            shards.push_back( unique_ptr<Shard>( new Shard( multiset, maxShard ) ) );
+        }
+    }
+
+    ShardedAvlTree( const ShardedAvlTree & ) = delete;
+    ShardedAvlTree & operator= ( const ShardedAvlTree & ) = delete;
+
+    /**
+     * Insert x into its shard.
+     */
+    void insert( const Comparable & x )
+    {
+        bool needsSplit;
+        {
+            shared_lock<shared_mutex> dir( directoryLock );
+            Shard & s = *shards[ shardFor( x ) ];
+            lock_guard<mutex> guard( s.lock );
+            s.tree.insert( x );
+            ++s.ops;
+            needsSplit = s.tree.size( ) > s.splitCheck;
+        }
+        if( needsSplit )
+            rebalance( );
+        else
+            countOp( );
+    }
+
+    /**
+     * Remove x from its shard. Nothing is done if x is not found.
+     */
+    void remove( const Comparable & x )
+    {
+        {
+            shared_lock<shared_mutex> dir( directoryLock );
+            Shard & s = *shards[ shardFor( x ) ];
+            lock_guard<mutex> guard( s.lock );
+            s.tree.remove( x );
+            ++s.ops;
+        }
+        countOp( );
+    }
+
+    /**
+     * Returns true if x is found.
+     */
+    bool contains( const Comparable & x ) const
+    {
+        return count( x ) > 0;
+    }
+
+    /**
+     * Return the number of occurrences of x.
+     *  Never re-shards; the read only adds to the shard's atomic load
+     *  counter, which the next mutator-driven rebalance( ) looks at.
+     */
+    int count( const Comparable & x ) const
+    {
+        shared_lock<shared_mutex> dir( directoryLock );
+        Shard & s = *shards[ shardFor( x ) ];
+        lock_guard<mutex> guard( s.lock );
+        ++s.ops;
+        return s.tree.count( x );
+    }
+
+    /**
+     * Return the total number of items.
+     *  Shards are read one at a time, so concurrent writers may skew it.
+     */
+    int size( ) const
+    {
+        shared_lock<shared_mutex> dir( directoryLock );
+        int total = 0;
+        for( auto & s : shards )
+        {
+            lock_guard<mutex> guard( s->lock );
+            total += s->tree.size( );
+        }
+        return total;
+    }
+
+    /**
+     * Return the current number of shards.
+     */
+    int shardCount( ) const
+    {
+        shared_lock<shared_mutex> dir( directoryLock );
+        return shards.size( );
+    }
+
+    /**
+     * Call f( x ) in sorted order for every item with lo <= x <= hi.
+     *  Shards own disjoint ascending ranges, so visiting the covering
+     *  shards left to right yields one merged, ordered stream. Each
+     *  shard is locked only while it is being visited.
+     */
+    template <typename Func>
+    void forEachInRange( const Comparable & lo, const Comparable & hi, Func f ) const
+    {
+        if( hi < lo )
+            return;
+        shared_lock<shared_mutex> dir( directoryLock );
+        size_t last = shardFor( hi );
+        for( size_t i = shardFor( lo ); i <= last; i++ )
+        {
+            lock_guard<mutex> guard( shards[i]->lock );
+            shards[i]->tree.forEachInRange( lo, hi, f );
+        }
+    }
+
+    /**
+     * Re-shard: split oversized or hot shards at their median and join
+     *  neighbouring shards that are both small. Called automatically
+     *  from insert( ) and remove( ) only. An oversized shard is split
+     *  until its pieces fit or hold a single key; a hot one is split once.
+     */
+    void rebalance( )
+    {
+        unique_lock<shared_mutex> dir( directoryLock );
+        opsSinceRebalance = 0;
+
+        unsigned long totalOps = 0;
+        for( auto & s : shards )
+            totalOps += s->ops;
+        unsigned long averageOps = totalOps / shards.size( );
+        unsigned long hotOps = 2 * averageOps + HOT_MIN_OPS;
+
+        size_t splitEnd = 0;     // Shards before this come from splits this pass
+        for( size_t i = 0; i < shards.size( ); )
+        {
+            AvlTree<Comparable> & tree = shards[i]->tree;
+            bool hot = i >= splitEnd && shards[i]->ops > hotOps && tree.size( ) >= HOT_MIN_SIZE;
+            if( ( tree.size( ) > maxShard || hot ) && split( i ) )
+                splitEnd = i < splitEnd ? splitEnd + 1 : i + 2;   // Look at the lower piece again
+            else
+                i++;
+        }
+
+        for( size_t i = 0; i + 1 < shards.size( ); )
+        {
+            int merged = shards[i]->tree.size( ) + shards[i + 1]->tree.size( );
+            unsigned long load = shards[i]->ops + shards[i + 1]->ops;
+            if( merged <= maxShard / 4 && load <= averageOps )
+            {
+                shards[i]->tree.join( shards[i + 1]->tree );
+                shards[i]->ops += shards[i + 1]->ops;
+                shards.erase( shards.begin( ) + i + 1 );
+                lowBounds.erase( lowBounds.begin( ) + i );
+            }
+            else
+                i++;
+        }
+
+        // A shard that is still too big holds one key and can't be cut.
+        //  Hysteresis: its inserts don't call rebalance( ) again until it
+        //  has grown by half.
+        for( auto & s : shards )
+        {
+            int size = s->tree.size( );
+            s->splitCheck = size > maxShard ? size + size / 2 : maxShard;
+            s->ops = 0;
+        }
+    }
+
+  private:
+    static const int HOT_MIN_SIZE = 64;            // Don't split tiny hot shards
+    static const unsigned long HOT_MIN_OPS = 4096;
+    static const unsigned long REBALANCE_INTERVAL = 1 << 16;
+
+    struct Shard
+    {
+        mutable mutex lock;
+        AvlTree<Comparable> tree;
+        mutable atomic<unsigned long> ops;     // Operations since last rebalance
+        int splitCheck;     // Size past which an insert triggers rebalance( )
+
+        Shard( bool isMultiset, int maxShardSize )
+          : tree( isMultiset ), ops( 0 ), splitCheck( maxShardSize ) { }
+    };
+
+    vector< unique_ptr<Shard> > shards;
+    vector<Comparable> lowBounds;     // lowBounds[i] starts shards[i + 1]
+    mutable shared_mutex directoryLock;
+    int maxShard;
+    bool multiset;
+    atomic<unsigned long> opsSinceRebalance;
+
+    /**
+     * Index of the shard owning x. Caller holds directoryLock.
+     */
+    size_t shardFor( const Comparable & x ) const
+    {
+        return upper_bound( lowBounds.begin( ), lowBounds.end( ), x ) - lowBounds.begin( );
+    }
+
+    /**
+     * Split shard i at its median into shards i and i + 1. If the
+     *  smallest key fills the lower half (a multiset with a heavy key),
+     *  cut just above it instead. Returns false if the shard holds a
+     *  single key. Caller holds directoryLock exclusively.
+     */
+    bool split( size_t i )
+    {
+        AvlTree<Comparable> & tree = shards[i]->tree;
+        if( tree.size( ) < 2 )
+            return false;
+        Comparable cut = tree.findKth( tree.size( ) / 2 );
+        if( !( tree.findMin( ) < cut ) )
+        {
+            int heavy = tree.count( cut );     // cut is the minimum
+            if( heavy >= tree.size( ) )
+                return false;
+            cut = tree.findKth( heavy );
+        }
+        unique_ptr<Shard> upper( new Shard( multiset, maxShard ) );
+        tree.split( cut, upper->tree );
+        shards[i]->ops = shards[i]->ops / 2;
+        upper->ops = shards[i]->ops.load( );
+        shards.insert( shards.begin( ) + i + 1, move( upper ) );
+        lowBounds.insert( lowBounds.begin( ) + i, cut );
+        return true;
+    }
+
+    /**
+     * Count one operation and re-shard every REBALANCE_INTERVAL of them.
+     */
+    void countOp( )
+    {
+        if( ++opsSinceRebalance >= REBALANCE_INTERVAL )
+            rebalance( );
+    }
+};
+
+#endif
@@ -0,0 +1,610 @@
+#ifndef SHARED_AVL_TREE_H
+#define SHARED_AVL_TREE_H
+
+#include "dsexceptions.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>        // For placement new
+#include <string>
+#include <thread>     // For this_thread::yield()
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>     // For O_* flags
+#include <sys/file.h>  // For flock()
+#include <sys/mman.h>  // For shm_open(), mmap()
+#include <sys/stat.h>
+#include <unistd.h>    // For ftruncate(), close()
+using namespace std;
+
+// SharedAvlTree class
+//
+// CONSTRUCTION: with a POSIX shared-memory name ("/something") and, for
+//  the writer, the size of the region in bytes
+//
+// An AVL tree whose nodes live in a named shared-memory region, so that
+// one writer process can maintain a read-mostly set while any number of
+// reader processes query the same copy in place. Links are byte offsets
+// from the start of the region rather than pointers, so every process
+// may map the region at a different address.
+//
+// Readers never lock. The writer bumps a sequence counter to an odd value
+// before each mutation and to the next even value after it; a reader that
+// sees the counter change (or odd) while it walked the tree retries. Every
+// offset a reader follows is bounds checked first, so a walk that races a
+// rotation or a reused node can read stale values but never leaves the
+// region. Comparable must therefore be trivially copyable.
+//
+// Only one writer may hold a region at a time (enforced with flock). The
+// same lock tells readers whether the writer is alive: a reader that
+// finds an update in progress yields while it waits, and throws
+// IOException if the region's lock is free, i.e. the writer died mid-update.
+// Nothing records how far that update got, so the region stays refused:
+// a new writer throws IOException as well, and the owner must unlink the
+// name and rebuild the set. Freed nodes are kept on a free list inside the
+// region; the region never grows.
+//
+// ******************PUBLIC OPERATIONS*********************
+// SharedAvlTree( name, bytes ) --> Writer: create, or reattach to, a region
+// SharedAvlTree( name )  --> Reader: map an existing region read-only
+// void insert( x )       --> Insert x (writer only)
+// void remove( x )       --> Remove x (writer only)
+// void makeEmpty( )      --> Remove all items (writer only)
+// bool contains( x )     --> Return true if x is present
+// Comparable findMin( ) / findMax( ) --> Smallest / largest item
+// int size( )            --> Number of items
+// bool isEmpty( )        --> Return true if empty
+// vector<Comparable> snapshot( ) --> All items in sorted order
+// unsigned long version( ) --> Completed mutations so far
+// static void unlink( name ) --> Remove the name; maps stay valid
+// ******************ERRORS********************************
+// IOException if the region cannot be created, mapped, locked, is
+//  corrupt, or its writer died mid-update; OverflowException when the region is full;
+//  IllegalArgumentException for a mutation through a reader;
+//  UnderflowException for findMin/findMax on an empty tree
+
+template <typename Comparable>
+class SharedAvlTree
+{
+    static_assert( is_trivially_copyable<Comparable>::value,
+                   "SharedAvlTree keys are copied byte for byte between processes" );
+    static_assert( atomic<uint64_t>::is_always_lock_free,
+                   "The sequence counter must be address free" );
+
+  public:
+    /**
+     * Writer: create the region, or reattach to one this key type laid out.
+     */
+    SharedAvlTree( const string & name, size_t bytes ) : writer( true )
+    {
+        if( bytes < sizeof( Header ) + sizeof( Node ) )
+            throw IllegalArgumentException( );
+
+        fd = shm_open( name.c_str( ), O_RDWR | O_CREAT, 0644 );
+        if( fd < 0 )
+            throw IOException( );
+        if( flock( fd, LOCK_EX | LOCK_NB ) != 0 )
+        {
+            ::close( fd );
+            throw IOException( );     // Another writer holds it
+        }
+
+        struct stat st;
+        if( fstat( fd, &st ) != 0 )
+            fail( );
+        bool fresh = st.st_size == 0;
+        if( fresh && ftruncate( fd, bytes ) != 0 )
+            fail( );
+        capacity = fresh ? bytes : size_t( st.st_size );
+
+        base = static_cast<char *>( mmap( NULL, capacity, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED, fd, 0 ) );
+        if( base == MAP_FAILED )
+            fail( );
+
+        if( fresh )
+        {
+            Header *h = new( base ) Header( );
+            h->capacity = capacity;
+            h->nodeSize = sizeof( Node );
+            h->bump = sizeof( Header );
+            h->magic = MAGIC;     // Last: marks the header complete
+        }
+        else
+        {
+            checkHeader( );
+            if( header( ).seq.load( ) & 1 )      // Last writer died mid-update
+            {
+                munmap( base, capacity );
+                fail( );
+            }
+        }
+    }
+
+    /**
+     * Reader: map an existing region read-only.
+     */
+    explicit SharedAvlTree( const string & name ) : writer( false )
+    {
+        fd = shm_open( name.c_str( ), O_RDONLY, 0 );
+        if( fd < 0 )
+            throw IOException( );
+
+        struct stat st;
+        if( fstat( fd, &st ) != 0 || size_t( st.st_size ) < sizeof( Header ) )
+            fail( );
+        capacity = st.st_size;
+
+        base = static_cast<char *>( mmap( NULL, capacity, PROT_READ, MAP_SHARED, fd, 0 ) );
+        if( base == MAP_FAILED )
+            fail( );
+        checkHeader( );
+    }
+
+    SharedAvlTree( const SharedAvlTree & ) = delete;
+    SharedAvlTree & operator= ( const SharedAvlTree & ) = delete;
+
+    ~SharedAvlTree( )
+    {
+        munmap( base, capacity );
+        ::close( fd );     // Also drops the writer's flock
+    }
+
+    /**
+     * Remove the name. Processes that have it mapped keep their view.
+     */
+    static void unlink( const string & name )
+    {
+        shm_unlink( name.c_str( ) );
+    }
+
+    bool contains( const Comparable & x ) const
+    {
+        bool found = false;
+        read( [ & ]( ) {
+            found = false;
+            uint64_t t = header( ).root.load( memory_order_relaxed );
+            for( int depth = 0; t != 0; depth++ )
+            {
+                Node n;
+                if( depth > MAX_DEPTH || !load( t, n ) )
+                    return false;
+                if( x < n.element )
+                    t = n.left;
+                else if( n.element < x )
+                    t = n.right;
+                else
+                {
+                    found = true;
+                    break;
+                }
+            }
+            return true;
+        } );
+        return found;
+    }
+
+    const Comparable findMin( ) const
+    {
+        return extreme( false );
+    }
+
+    const Comparable findMax( ) const
+    {
+        return extreme( true );
+    }
+
+    int size( ) const
+    {
+        return int( header( ).size.load( memory_order_acquire ) );
+    }
+
+    bool isEmpty( ) const
+    {
+        return size( ) == 0;
+    }
+
+    /**
+     * Number of mutations started so far, counting one in progress.
+     */
+    unsigned long version( ) const
+    {
+        return header( ).seq.load( memory_order_acquire ) / 2;
+    }
+
+    /**
+     * Return every item in sorted order, as of one consistent moment.
+     */
+    vector<Comparable> snapshot( ) const
+    {
+        vector<Comparable> items;
+        read( [ & ]( ) {
+            items.clear( );
+            return collect( header( ).root.load( memory_order_relaxed ), 0, items );
+        } );
+        return items;
+    }
+
+    void insert( const Comparable & x )
+    {
+        WriteSection section( *this );
+        insert( x, header( ).root );
+    }
+
+    void insert( const vector<Comparable> & vals )
+    {
+        for( const Comparable & x : vals )
+            insert( x );
+    }
+
+    void remove( const Comparable & x )
+    {
+        WriteSection section( *this );
+        remove( x, header( ).root );
+    }
+
+    void makeEmpty( )
+    {
+        WriteSection section( *this );
+        Header & h = header( );
+        h.root.store( 0, memory_order_relaxed );
+        h.size.store( 0, memory_order_relaxed );
+        h.freeList = 0;
+        h.bump = sizeof( Header );
+    }
+
+  private:
+    static const uint64_t MAGIC = 0x4156'4c53'484d'0001ull;   // "AVLSHM" v1
+    static const int MAX_DEPTH = 96;     // Far beyond any AVL height in memory
+
+    /**
+     * Offset 0 is the header, so it doubles as the null link.
+     */
+    struct Node
+    {
+        Comparable element;
+        uint64_t   left;
+        uint64_t   right;
+        int32_t    height;
+    };
+
+    struct Header
+    {
+        uint64_t magic = 0;
+        uint64_t capacity = 0;
+        uint64_t nodeSize = 0;
+        atomic<uint64_t> seq { 0 };      // Odd while the writer is mid-update
+        atomic<uint64_t> root { 0 };
+        atomic<uint64_t> size { 0 };
+        uint64_t freeList = 0;           // Chained through Node::left
+        uint64_t bump = 0;               // First never-used byte
+    };
+
+    /**
+     * Brackets one mutation with the odd/even sequence bumps.
+     */
+    struct WriteSection
+    {
+        Header & h;
+
+        WriteSection( SharedAvlTree & tree ) : h( tree.writableHeader( ) )
+        {
+            h.seq.store( h.seq.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+            atomic_thread_fence( memory_order_release );
+        }
+
+        ~WriteSection( )
+        {
+            h.seq.store( h.seq.load( memory_order_relaxed ) + 1, memory_order_release );
+        }
+    };
+
+    bool   writer;
+    int    fd;
+    char  *base;
+    size_t capacity;
+
+    Header & header( ) const
+    {
+        return *reinterpret_cast<Header *>( base );
+    }
+
+    Header & writableHeader( )
+    {
+        if( !writer )
+            throw IllegalArgumentException( );
+        return header( );
+    }
+
+    void fail( )
+    {
+        ::close( fd );
+        throw IOException( );
+    }
+
+    /**
+     * A live writer holds an exclusive flock on the region. Probing with
+     *  a shared lock must not touch the writer's own descriptor.
+     */
+    bool writerAlive( ) const
+    {
+        if( writer || flock( fd, LOCK_SH | LOCK_NB ) != 0 )
+            return true;
+        flock( fd, LOCK_UN );
+        return false;
+    }
+
+    void checkHeader( )
+    {
+        const Header & h = header( );
+        if( h.magic != MAGIC || h.capacity != capacity || h.nodeSize != sizeof( Node ) )
+        {
+            munmap( base, capacity );
+            fail( );
+        }
+    }
+
+    /**
+     * True if a reader may follow offset t: inside the region, on a node
+     *  boundary and past the header.
+     */
+    bool valid( uint64_t t ) const
+    {
+        return t >= sizeof( Header ) && t <= capacity - sizeof( Node ) &&
+               ( t - sizeof( Header ) ) % sizeof( Node ) == 0;
+    }
+
+    /**
+     * Copy node t out of the region, so that a torn read stays local.
+     */
+    bool load( uint64_t t, Node & n ) const
+    {
+        if( !valid( t ) )
+            return false;
+        memcpy( static_cast<void *>( &n ), base + t, sizeof( Node ) );
+        return true;
+    }
+
+    Node & at( uint64_t t ) const
+    {
+        return *reinterpret_cast<Node *>( base + t );
+    }
+
+    /**
+     * Run walk( ) until it completes inside one quiet sequence window.
+     *  walk returns false if it hit an impossible link; that is only a
+     *  race unless the window was quiet, in which case the region is bad.
+     *  While an update is in progress, every SPINS tries yield the CPU and
+     *  check that the writer is still alive; a dead one throws IOException.
+     */
+    template <typename Walk>
+    void read( Walk walk ) const
+    {
+        const int SPINS = 1024;
+        const Header & h = header( );
+        for( int spins = 0; ; )
+        {
+            uint64_t before = h.seq.load( memory_order_acquire );
+            if( before & 1 )
+            {
+                if( ++spins % SPINS == 0 )
+                {
+                    // The lock is dropped after the last even bump, so a
+                    //  free lock with the count still odd means a crash
+                    if( !writerAlive( ) && h.seq.load( memory_order_acquire ) == before )
+                        throw IOException( );
+                    this_thread::yield( );
+                }
+                continue;
+            }
+            bool ok = walk( );
+            atomic_thread_fence( memory_order_acquire );
+            if( h.seq.load( memory_order_relaxed ) == before )
+            {
+                if( !ok )
+                    throw IOException( );
+                return;
+            }
+        }
+    }
+
+    const Comparable extreme( bool largest ) const
+    {
+        Comparable result;
+        bool empty = false;
+        read( [ & ]( ) {
+            uint64_t t = header( ).root.load( memory_order_relaxed );
+            empty = t == 0;
+            for( int depth = 0; t != 0; depth++ )
+            {
+                Node n;
+                if( depth > MAX_DEPTH || !load( t, n ) )
+                    return false;
+                result = n.element;
+                t = largest ? n.right : n.left;
+            }
+            return true;
+        } );
+        if( empty )
+            throw UnderflowException( );
+        return result;
+    }
+
+    bool collect( uint64_t t, int depth, vector<Comparable> & items ) const
+    {
+        if( t == 0 )
+            return true;
+        Node n;
+        if( depth > MAX_DEPTH || !load( t, n ) || items.size( ) > capacity / sizeof( Node ) )
+            return false;
+        if( !collect( n.left, depth + 1, items ) )
+            return false;
+        items.push_back( n.element );
+        return collect( n.right, depth + 1, items );
+    }
+
+    /**
+     * Take a node from the free list, else from the unused tail.
+     */
+    uint64_t allocate( const Comparable & x )
+    {
+        Header & h = header( );
+        uint64_t t = h.freeList;
+        if( t != 0 )
+            h.freeList = at( t ).left;
+        else
+        {
+            if( h.bump + sizeof( Node ) > capacity )
+                throw OverflowException( );
+            t = h.bump;
+            h.bump += sizeof( Node );
+        }
+        Node & n = at( t );
+        n.element = x;
+        n.left = n.right = 0;
+        n.height = 0;
+        h.size.store( h.size.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+        return t;
+    }
+
+    void release( uint64_t t )
+    {
+        Header & h = header( );
+        at( t ).left = h.freeList;
+        h.freeList = t;
+        h.size.store( h.size.load( memory_order_relaxed ) - 1, memory_order_relaxed );
+    }
+
+    /**
+     * The writer's walks below mirror AvlTree's, with offsets for pointers.
+     *  The writer is the only mutator, so it reads the region directly.
+     */
+    template <typename Link>
+    void insert( const Comparable & x, Link & t )
+    {
+        uint64_t cur = get( t );
+        if( cur == 0 )
+        {
+            set( t, allocate( x ) );
+            return;
+        }
+        if( x < at( cur ).element )
+            insert( x, at( cur ).left );
+        else if( at( cur ).element < x )
+            insert( x, at( cur ).right );
+        else
+            return;     // Duplicate; do nothing
+        balance( t );
+    }
+
+    template <typename Link>
+    void remove( const Comparable & x, Link & t )
+    {
+        uint64_t cur = get( t );
+        if( cur == 0 )
+            return;
+
+        Node & n = at( cur );
+        if( x < n.element )
+            remove( x, n.left );
+        else if( n.element < x )
+            remove( x, n.right );
+        else if( n.left != 0 && n.right != 0 )   // Two children
+        {
+            uint64_t successor = n.right;
+            while( at( successor ).left != 0 )
+                successor = at( successor ).left;
+            n.element = at( successor ).element;
+            remove( n.element, n.right );
+        }
+        else
+        {
+            set( t, n.left != 0 ? n.left : n.right );
+            release( cur );
+        }
+        balance( t );
+    }
+
+    /**
+     * The root link is an atomic in the header; all others are plain.
+     */
+    static uint64_t get( const atomic<uint64_t> & t )
+    {
+        return t.load( memory_order_relaxed );
+    }
+
+    static uint64_t get( const uint64_t & t )
+    {
+        return t;
+    }
+
+    static void set( atomic<uint64_t> & t, uint64_t v )
+    {
+        t.store( v, memory_order_relaxed );
+    }
+
+    static void set( uint64_t & t, uint64_t v )
+    {
+        t = v;
+    }
+
+    int height( uint64_t t ) const
+    {
+        return t == 0 ? -1 : at( t ).height;
+    }
+
+    void update( uint64_t t )
+    {
+        Node & n = at( t );
+        int l = height( n.left ), r = height( n.right );
+        n.height = ( l > r ? l : r ) + 1;
+    }
+
+    template <typename Link>
+    void balance( Link & link )
+    {
+        uint64_t t = get( link );
+        if( t == 0 )
+            return;
+
+        Node & n = at( t );
+        if( height( n.left ) - height( n.right ) == 2 )
+        {
+            if( height( at( n.left ).left ) < height( at( n.left ).right ) )
+                rotateWithRightChild( n.left );
+            rotateWithLeftChild( link );
+        }
+        else if( height( n.right ) - height( n.left ) == 2 )
+        {
+            if( height( at( n.right ).right ) < height( at( n.right ).left ) )
+                rotateWithLeftChild( n.right );
+            rotateWithRightChild( link );
+        }
+        else
+            update( t );
+    }
+
+    template <typename Link>
+    void rotateWithLeftChild( Link & link )
+    {
+        uint64_t k2 = get( link ), k1 = at( k2 ).left;
+        at( k2 ).left = at( k1 ).right;
+        at( k1 ).right = k2;
+        update( k2 );
+        update( k1 );
+        set( link, k1 );
+    }
+
+    template <typename Link>
+    void rotateWithRightChild( Link & link )
+    {
+        uint64_t k1 = get( link ), k2 = at( k1 ).right;
+        at( k1 ).right = at( k2 ).left;
+        at( k2 ).left = k1;
+        update( k1 );
+        update( k2 );
+        set( link, k2 );
+    }
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef STATIC_AVL_TREE_H
+#define STATIC_AVL_TREE_H
+
+#include "dsexceptions.h"
+#include <algorithm>   // For constexpr sort (C++20)
+#include <array>
+#include <cstddef>
+using namespace std;
+
+// StaticAvlTree class
+//
+// CONSTRUCTION: at compile time from a fixed list of items, usually as
+//  constexpr auto table = makeStaticAvlTree<int>( { 5, 3, 9 } );
+//
+// A read-only balanced search tree for key sets fixed at build time. The
+// constexpr constructor sorts the items and lays them out in Eytzinger
+// (breadth-first) order: the node at index k has children 2k+1 and 2k+2,
+// so no links are stored and the layout is a complete binary tree, which
+// is as balanced as any AVL tree. A constexpr table lives in read-only
+// data: no startup cost, no heap, and every lookup can be inlined or
+// folded at compile time.
+//
+// Comparable must be a literal type with a constexpr operator<.
+//
+// ******************PUBLIC OPERATIONS*********************
+// bool contains( x )     --> Return true if x is present
+// Comparable findMin( )  --> Return smallest item
+// Comparable findMax( )  --> Return largest item
+// int size( )            --> Number of items (N)
+// bool isEmpty( )        --> Return true if N == 0
+// int height( )          --> Height of the tree (null == -1)
+// int rank( x )          --> Number of items strictly less than x
+// ******************ERRORS********************************
+// Throws IllegalArgumentException for duplicate items (a compile error
+//  when evaluated as a constant); UnderflowException for findMin/findMax
+//  on an empty tree
+
+template <typename Comparable, size_t N>
+class StaticAvlTree
+{
+  public:
+    constexpr StaticAvlTree( const array<Comparable, N> & items ) : nodes( )
+    {
+        array<Comparable, N> sorted = items;
+        sort( sorted.begin( ), sorted.end( ) );
+        for( size_t i = 1; i < N; i++ )
+            if( !( sorted[i - 1] < sorted[i] ) )
+                throw IllegalArgumentException( );
+
+        size_t next = 0;
+        layout( sorted, 0, next );
+    }
+
+    /**
+     * Branch on each comparison down the implicit tree.
+     */
+    constexpr bool contains( const Comparable & x ) const
+    {
+        size_t k = 0;
+        while( k < N )
+        {
+            if( x < nodes[k] )
+                k = 2 * k + 1;
+            else if( nodes[k] < x )
+                k = 2 * k + 2;
+            else
+                return true;    // Match
+        }
+        return false;
+    }
+
+    constexpr const Comparable & findMin( ) const
+    {
+        if( N == 0 )
+            throw UnderflowException( );
+        size_t k = 0;
+        while( 2 * k + 1 < N )
+            k = 2 * k + 1;
+        return nodes[k];
+    }
+
+    constexpr const Comparable & findMax( ) const
+    {
+        if( N == 0 )
+            throw UnderflowException( );
+        size_t k = 0;
+        while( 2 * k + 2 < N )
+            k = 2 * k + 2;
+        return nodes[k];
+    }
+
+    /**
+     * Number of items strictly less than x. Subtree sizes of a complete
+     *  tree follow from N, so none are stored.
+     */
+    constexpr int rank( const Comparable & x ) const
+    {
+        int less = 0;
+        size_t k = 0;
+        while( k < N )
+        {
+            if( nodes[k] < x )
+            {
+                less += subtreeSize( 2 * k + 1 ) + 1;
+                k = 2 * k + 2;
+            }
+            else
+                k = 2 * k + 1;
+        }
+        return less;
+    }
+
+    constexpr int size( ) const
+    {
+        return int( N );
+    }
+
+    constexpr bool isEmpty( ) const
+    {
+        return N == 0;
+    }
+
+    constexpr int height( ) const
+    {
+        int h = -1;
+        for( size_t k = 0; k < N; k = 2 * k + 1 )
+            h++;
+        return h;
+    }
+
+  private:
+    array<Comparable, N> nodes;     // Eytzinger order
+
+    /**
+     * Fill subtree k with sorted[next...] by an in-order walk.
+     */
+    constexpr void layout( const array<Comparable, N> & sorted, size_t k, size_t & next )
+    {
+        if( k >= N )
+            return;
+        layout( sorted, 2 * k + 1, next );
+        nodes[k] = sorted[next++];
+        layout( sorted, 2 * k + 2, next );
+    }
+
+    /**
+     * Number of nodes in the subtree rooted at index k.
+     */
+    static constexpr int subtreeSize( size_t k )
+    {
+        int count = 0;
+        for( size_t first = k, width = 1; first < N; first = 2 * first + 1, width *= 2 )
+            count += int( ( first + width <= N ? width : N - first ) );
+        return count;
+    }
+};
+
+/**
+ * Deduces N from a braced list: makeStaticAvlTree<int>( { 1, 2, 3 } ).
+ */
+template <typename Comparable, size_t N>
+constexpr StaticAvlTree<Comparable, N> makeStaticAvlTree( const Comparable ( &items )[N] )
+{
+    array<Comparable, N> a { };
+    for( size_t i = 0; i < N; i++ )
+        a[i] = items[i];
+    return StaticAvlTree<Comparable, N>( a );
+}
+
+#endif
@@ -2,11 +2,13 @@
 #define DS_EXCEPTIONS_H
 
 class UnderflowException { };
+class OverflowException { };
 class IllegalArgumentException { };
 class ArrayIndexOutOfBoundsException { };
 class IteratorOutOfBoundsException { };
 class IteratorMismatchException { };
 class IteratorUninitializedException { };
+class IOException { };
 
 #endif
 
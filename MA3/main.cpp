@@ -10,6 +10,8 @@
 #include <string.h>
 #include "AvlTree.h"
 #include "AvlTreeTesting.h"
+#include "AvlTreeBenchmark.h"
+#include "AvlTreeReplay.h"
 using namespace std;
 
 /*
@@ -30,6 +32,22 @@ int main( int argc, char* argv[] )
 		retState = avlTreeTests( withFuzzing );          // From AvlTreeTesting.h
 		cout << " [x] Program complete. " << endl;
 	}
+	else if( argc > 1 && !strcmp(argv[1], "--benchmark" ) )
+	{
+		cout << " [x] Running in benchmark mode. " << endl;
+		retState = avlTreeBenchmarks( );           // From AvlTreeBenchmark.h
+	}
+	else if( argc > 2 && !strcmp(argv[1], "--replay" ) )
+	{
+		// ./avltree --replay <tracefile> [--threads N]
+		int threads = 1;
+		if( argc > 4 && !strcmp(argv[3], "--threads" ) )
+			threads = atoi( argv[4] );
+		if( threads < 1 )
+			threads = 1;
+		cout << " [x] Running in replay mode. " << endl;
+		retState = avlTreeReplay( argv[2], threads );   // From AvlTreeReplay.h
+	}
 	else
 	{
 		cout << " [x] Running in normal mode. " << endl;
@@ -37,6 +55,7 @@ int main( int argc, char* argv[] )
 		cout << "   ___.___\n     (_]===*\n     o 0" << endl;
 		cout << endl << " You should probably run 'make test' to test your program. " << endl;
 		cout << "  This program also has a fuzzing test with 'make bigtest' to test your program. " << endl;
+		cout << "  Replay a captured workload with './avltree --replay <tracefile> [--threads N]'. " << endl;
 		//system("pause");
 	}
 	return(retState);